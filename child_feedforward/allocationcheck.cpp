@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+// Checks what allocationCount() is for: once warmed up, propagating a sample or a batch and an update() tick make no heap
+// allocations. Built and run by "make check", exits with 1 when any of them allocates.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "allocations.h"
+#include "neuralnet.h"
+#include "neuralhost.h"
+#include "threadpool.h"
+
+#define CHECK_ITERATIONS 100 ///< calls counted after the warm up call
+
+/// calls step once to warm up, then CHECK_ITERATIONS times counting allocations; prints the result and fails on any
+static bool expectNoAllocations(std::string what, std::function<void()> step) {
+    step(); // first calls may size buffers
+    size_t before = allocationCount();
+    for (int i = 0; i < CHECK_ITERATIONS; i++) step();
+    size_t made = allocationCount() - before;
+    std::cout << (made == 0 ? "ok    " : "FAILED") << " " << what << ": " << made << " allocations in " << CHECK_ITERATIONS << " calls" << std::endl;
+    return made == 0;
+}
+
+/// a network of inputs x width x outputs with random weights
+template <typename Scalar>
+static void buildNetwork(NeuralNet<Scalar> &net, int inputs, int width, int outputs) {
+    for (int i = 0; i < inputs; i++) net.addInput("in" + std::to_string(i));
+    for (int i = 0; i < outputs; i++) net.addOutput("out" + std::to_string(i));
+    net.addLayerBeforeOutputLayer(width, inputs);
+}
+
+/// propagate() and propagateBatch() into caller buffers, dense, sparse and split across a thread pool
+template <typename Scalar>
+static bool checkPropagation(std::string precision) {
+    bool passed = true;
+    const int inputs = 16, outputs = 4, batch = 64;
+    std::vector<Scalar> sample(inputs, 0.5), result(outputs), samples((size_t)batch * inputs, 0.25), results((size_t)batch * outputs);
+    auto propagate = [&](NeuralNet<Scalar> &net) { net.propagate(Span<const Scalar>(sample), Span<Scalar>(result)); };
+    auto propagateBatch = [&](NeuralNet<Scalar> &net) { net.propagateBatch(Span<const Scalar>(samples), batch, Span<Scalar>(results)); };
+
+    NeuralNet<Scalar> dense;
+    buildNetwork(dense, inputs, 64, outputs);
+    passed &= expectNoAllocations(precision + " propagate", [&] { propagate(dense); });
+    passed &= expectNoAllocations(precision + " propagateBatch", [&] { propagateBatch(dense); });
+
+    NeuralNet<Scalar> sparse;
+    buildNetwork(sparse, inputs, 64, outputs);
+    sparse.pruneFraction(0.9);
+    passed &= expectNoAllocations(precision + " sparse propagate", [&] { propagate(sparse); });
+    passed &= expectNoAllocations(precision + " sparse propagateBatch", [&] { propagateBatch(sparse); });
+
+    ThreadPool pool(4, false);
+    NeuralNet<Scalar> wide;
+    buildNetwork(wide, inputs, 2 * PARALLEL_MIN_WIDTH, outputs);
+    wide.setThreadPool(&pool, PARALLEL_MIN_WIDTH);
+    passed &= expectNoAllocations(precision + " threaded propagate", [&] { propagate(wide); });
+    passed &= expectNoAllocations(precision + " threaded propagateBatch", [&] { propagateBatch(wide); });
+    return passed;
+}
+
+/// NeuralHost::update() reading a mapped input file and writing the output file, with the dynamic and quantized network
+template <typename Scalar>
+static bool checkUpdate(std::string precision, std::string directory) {
+    std::string structure = directory + "/check.structure", weights = directory + "/check.weights", inputs = directory + "/inputs", data = directory + "/calibration.txt";
+    std::ofstream(structure) << "x z w\nb c d\n3 3\n3 3\n";
+    std::ofstream(weights) << "0.1 0.2 0.3 0.4 0.5 0.6 0.7 0.8 0.9 1.0 1.1 1.2 0.1 0.2 0.3 0.4 0.5 0.6 0.7 0.8 0.9 1.0 1.1 1.2\n";
+    std::ofstream(inputs) << "p 0.5\nq 0.25\n";
+    std::ofstream(data) << "0.1 0.2 0.3 : 0.4 0.5 0.6\n0.9 0.8 0.7 : 0.6 0.5 0.4\n";
+
+    NeuralHost<Scalar> host(&structure[0], &weights[0]);
+    host.runCommand("addinputmapping " + inputs + " p x");
+    host.runCommand("addinputmapping " + inputs + " q z");
+    host.runCommand("setoutputfile " + directory + "/outputs");
+    bool passed = expectNoAllocations(precision + " update", [&] { host.update(); });
+    host.runCommand("quantize " + data);
+    passed &= expectNoAllocations(precision + " quantized update", [&] { host.update(); });
+    return passed;
+}
+
+int main() {
+    char directory[] = "/tmp/allocationcheck.XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::cerr << "ERROR: could not create a directory for the check's files" << std::endl;
+        return 1;
+    }
+    bool passed = checkPropagation<float>("float") & checkPropagation<double>("double");
+    passed &= checkUpdate<float>("float", directory) & checkUpdate<double>("double", directory);
+    system(("rm -rf " + std::string(directory)).c_str());
+    std::cout << (passed ? "All allocation checks passed" : "ERROR: allocation checks failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+// Replaces the global allocation functions so allocationCount() sees every operator new in the program.
+
+#include <new>
+#include <stdlib.h>
+
+#include "allocations.h"
+
+static void *countedAllocate(size_t size) {
+    countAllocation();
+    void *p = malloc(size > 0 ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size) { return countedAllocate(size); }
+void *operator new[](size_t size) { return countedAllocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { countAllocation(); return malloc(size > 0 ? size : 1); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { countAllocation(); return malloc(size > 0 ? size : 1); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
@@ -0,0 +1,19 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+/// the running count of heap allocations made by the process (operator new, see allocations.cpp, and AlignedAllocator)
+inline std::atomic<size_t> &allocationCounter() {
+    static std::atomic<size_t> counter(0);
+    return counter;
+}
+
+/// returns the number of heap allocations made so far, diff two readings to check that a code path does not allocate
+inline size_t allocationCount() { return allocationCounter().load(std::memory_order_relaxed); }
+
+inline void countAllocation() { allocationCounter().fetch_add(1, std::memory_order_relaxed); }
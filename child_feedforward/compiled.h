@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+// The forward pass of networks generated by the compile command (see NeuralHost::compileNetwork). Every size is a template
+// argument, so there are no bounds or size checks left at run time. Weights are stored transposed, one row per input, so
+// each input is broadcast against a fixed length row of weights: that inner loop has no reduction, so it vectorizes without
+// reassociating sums and keeps the scalar kernels' summation order. Layers with up to
+// COMPILED_UNROLL_LIMIT inputs have their input loop unrolled completely by template recursion.
+//
+// On its own the sigmoid comes from libm. Define COMPILED_KERNEL_SIGMOID before including this to use the vectorized
+// kernels (and the Activation picked with selectActivation()) instead, as feedforward does.
+
+#include <math.h>
+
+#ifdef COMPILED_KERNEL_SIGMOID
+#include "kernels.h"
+#endif
+
+#define COMPILED_UNROLL_LIMIT 256 ///< the widest layer input (in values) that is fully unrolled
+
+namespace compiled {
+
+#ifdef COMPILED_KERNEL_SIGMOID
+template <typename T>
+inline void sigmoid(T *values, int n, T response) { kernels<T>().sigmoid(values, n, response); }
+#else
+template <typename T>
+inline void sigmoid(T *values, int n, T response) { for (int j = 0; j < n; j++) values[j] = 1 / (1 + exp(-values[j] / response)); }
+#endif
+
+/// outputs += weights[k] * inputs[k] for k in [Begin, Begin + Count), split in halves so the recursion depth is only log2(Count)
+template <typename T, int Rows, int Begin, int Count>
+struct Columns {
+    static inline void apply(const T (*weights)[Rows], const T *inputs, T *outputs) {
+        Columns<T, Rows, Begin, Count / 2>::apply(weights, inputs, outputs);
+        Columns<T, Rows, Begin + Count / 2, Count - Count / 2>::apply(weights, inputs, outputs);
+    }
+};
+
+template <typename T, int Rows, int Begin>
+struct Columns<T, Rows, Begin, 1> {
+    static inline void apply(const T (*weights)[Rows], const T *inputs, T *outputs) {
+        const T input = inputs[Begin];
+        for (int j = 0; j < Rows; j++) outputs[j] += weights[Begin][j] * input;
+    }
+};
+
+template <typename T, int Rows, int Begin>
+struct Columns<T, Rows, Begin, 0> {
+    static inline void apply(const T (*)[Rows], const T *, T *) {}
+};
+
+/// one layer: bias, every input's contribution, then the sigmoid
+template <typename T, int Rows, int Cols, bool Unroll = (Cols <= COMPILED_UNROLL_LIMIT)>
+struct Layer {
+    static inline void apply(const T (&weights)[Cols][Rows], const T (&biases)[Rows], const T *inputs, T *outputs, T biasCoefficient, T response) {
+        for (int j = 0; j < Rows; j++) outputs[j] = 0;
+        Columns<T, Rows, 0, Cols>::apply(weights, inputs, outputs);
+        for (int j = 0; j < Rows; j++) outputs[j] += biases[j] * biasCoefficient;
+        sigmoid(outputs, Rows, response);
+    }
+};
+
+template <typename T, int Rows, int Cols>
+struct Layer<T, Rows, Cols, false> {
+    static inline void apply(const T (&weights)[Cols][Rows], const T (&biases)[Rows], const T *inputs, T *outputs, T biasCoefficient, T response) {
+        for (int j = 0; j < Rows; j++) outputs[j] = 0;
+        for (int k = 0; k < Cols; k++) Columns<T, Rows, 0, 1>::apply(weights + k, inputs + k, outputs);
+        for (int j = 0; j < Rows; j++) outputs[j] += biases[j] * biasCoefficient;
+        sigmoid(outputs, Rows, response);
+    }
+};
+
+} // namespace compiled
@@ -0,0 +1,488 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "dataset.h"
+#include "threadpool.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// rounds offset up to the next DATASET_ALIGNMENT boundary
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+}
+
+/// a stretch of whole lines of a text data file, parsed by one thread
+struct TextChunk {
+    const char *begin, *end;
+    size_t firstLine; ///< the number of its first line in the file, from 1
+    size_t lines;
+    size_t firstSample; ///< the index in the file of its first sample
+    size_t samples;
+    size_t errorLine, errorColumn; ///< where its first malformed line went wrong, from 1, errorLine is 0 while none has
+    std::string error;
+};
+
+/// parsing a text data file, as handed to the thread pool: one pass counts the lines and samples of every chunk, the next
+/// parses every chunk's samples into place
+template <typename Scalar>
+struct TextJob {
+    std::vector<TextChunk> chunks;
+    Scalar *inputs, *outputs; ///< row-major storage for every sample of the file
+    int inputCount, outputCount;
+    bool parse; ///< false for the counting pass
+    std::atomic<int> next; ///< the next chunk to take, parts take one at a time
+};
+
+/// returns the end of the line starting at line, before its newline and any carriage return; next gets the following line
+static const char *lineEnd(const char *line, const char *end, const char *&next) {
+    const char *newline = (const char *)memchr(line, '\n', end - line);
+    next = newline ? newline + 1 : end;
+    const char *stop = newline ? newline : end;
+    if (stop > line && stop[-1] == '\r') stop--;
+    return stop;
+}
+
+/// reads the number starting at text into value, returning where it ends or NULL when there is none
+template <typename Scalar>
+static const char *parseValue(const char *text, const char *stop, Scalar &value) {
+    if (text < stop && *text == '+') text++; // from_chars takes no plus sign
+#if defined(__cpp_lib_to_chars)
+    std::from_chars_result result = std::from_chars(text, stop, value);
+    return result.ec == std::errc() ? result.ptr : NULL;
+#else // a standard library without floating point from_chars: strtod on a terminated copy, which follows the C locale
+    char token[64];
+    size_t length = 0;
+    while (text + length < stop && length < sizeof(token) - 1 && text[length] != ' ' && text[length] != '\t' && text[length] != ':') {
+        token[length] = text[length];
+        length++;
+    }
+    token[length] = 0;
+    char *after;
+    errno = 0;
+    value = (Scalar)strtod(token, &after);
+    return after == token || errno == ERANGE ? NULL : text + (after - token);
+#endif
+}
+
+/// parses an "inputs : outputs" line of numbers separated by blanks into a sample's rows; fails with the column (from 1)
+/// and what is wrong there
+template <typename Scalar>
+static bool parseLine(const char *line, const char *stop, Scalar *inputs, int inputCount, Scalar *outputs, int outputCount, size_t &column, std::string &error) {
+    Scalar *rows[2] = { inputs, outputs };
+    const int expected[2] = { inputCount, outputCount };
+    const char *names[2] = { "inputs", "outputs" };
+    int side = 0, found = 0;
+    for (const char *text = line; ; ) {
+        while (text < stop && (*text == ' ' || *text == '\t')) text++;
+        column = text - line + 1;
+        if (text < stop && *text == ':' && side == 1) {
+            error = "more than one ':'";
+            return false;
+        }
+        if (text == stop || *text == ':') {
+            if (found != expected[side]) {
+                error = "expected " + std::to_string(expected[side]) + " " + names[side] + ", found " + std::to_string(found);
+                return false;
+            }
+            if (text == stop) {
+                if (side == 0) error = "expected ':' between the inputs and outputs";
+                return side == 1;
+            }
+            side = 1;
+            found = 0;
+            text++;
+            continue;
+        }
+        if (found == expected[side]) {
+            error = "more than " + std::to_string(expected[side]) + " " + names[side];
+            return false;
+        }
+        const char *after = parseValue(text, stop, rows[side][found]);
+        if (!after || (after < stop && *after != ' ' && *after != '\t' && *after != ':')) {
+            error = "not a number";
+            return false;
+        }
+        found++;
+        text = after;
+    }
+}
+
+/// ThreadPool::Task for a TextJob: each part takes chunks one at a time; lines starting with # are comments, and blank ones
+/// are skipped
+template <typename Scalar>
+static void parseTextTask(void *context, int part, int parts) {
+    TextJob<Scalar> &job = *(TextJob<Scalar> *)context;
+    for (int c = job.next++; c < (int)job.chunks.size(); c = job.next++) {
+        TextChunk &chunk = job.chunks[c];
+        size_t line = chunk.firstLine, sample = chunk.firstSample;
+        const char *next;
+        for (const char *text = chunk.begin; text < chunk.end; text = next, line++) {
+            const char *stop = lineEnd(text, chunk.end, next);
+            if (stop == text || text[0] == '#') continue;
+            if (job.parse && !parseLine(text, stop, job.inputs + sample * job.inputCount, job.inputCount, job.outputs + sample * job.outputCount, job.outputCount, chunk.errorColumn, chunk.error)) {
+                chunk.errorLine = line;
+                break;
+            }
+            sample++;
+        }
+        if (!job.parse) {
+            chunk.lines = line - chunk.firstLine;
+            chunk.samples = sample - chunk.firstSample;
+        }
+    }
+}
+
+/// true when an array of count rows of rowBytes each, starting at offset, ends within a file of fileBytes; divides rather
+/// than multiplies, so a header claiming more than 64 bits hold does not wrap around into a file that seems to fit
+static bool arrayFits(uint64_t offset, uint64_t count, uint64_t rowBytes, uint64_t fileBytes) {
+    return offset <= fileBytes && (rowBytes == 0 || count <= (fileBytes - offset) / rowBytes);
+}
+
+/// true when everything the header claims is in a file of fileBytes written on a machine of this byte order, where the arrays
+/// can be read in place
+static bool validHeader(const DatasetHeader &header, uint64_t fileBytes) {
+    return header.version == DATASET_VERSION && header.byteOrder == DATASET_BYTE_ORDER
+        && (header.scalarBytes == sizeof(float) || header.scalarBytes == sizeof(double))
+        && header.count <= INT_MAX && header.inputCount <= INT_MAX && header.outputCount <= INT_MAX
+        && header.inputsOffset >= sizeof(DatasetHeader) && header.outputsOffset >= sizeof(DatasetHeader)
+        && header.inputsOffset % DATASET_ALIGNMENT == 0 && header.outputsOffset % DATASET_ALIGNMENT == 0
+        && arrayFits(header.inputsOffset, header.count, (uint64_t)header.inputCount * header.scalarBytes, fileBytes)
+        && arrayFits(header.outputsOffset, header.count, (uint64_t)header.outputCount * header.scalarBytes, fileBytes);
+}
+
+template <typename Scalar>
+Dataset<Scalar>::Dataset() : mapping(NULL), mappingBytes(0), inputs(NULL), outputs(NULL), count(0), inputCount(0), outputCount(0) {}
+
+template <typename Scalar>
+Dataset<Scalar>::~Dataset() {
+    clear();
+}
+
+template <typename Scalar>
+void Dataset<Scalar>::clear() {
+    if (mapping) munmap(mapping, mappingBytes);
+    mapping = NULL;
+    mappingBytes = 0;
+    inputStorage.clear();
+    outputStorage.clear();
+    inputs = outputs = NULL;
+    count = 0;
+}
+
+template <typename Scalar>
+bool Dataset<Scalar>::load(std::string filename, int inputs, int outputs) {
+    clear();
+    inputCount = inputs;
+    outputCount = outputs;
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        std::cerr << "ERROR: could not open data file " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    char magic[sizeof(DatasetHeader::magic)] = {};
+    bool binary = read(descriptor, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, DATASET_MAGIC, sizeof(magic)) == 0;
+    bool loaded = binary ? loadBinary(filename, descriptor) : loadText(filename, descriptor);
+    close(descriptor); // a mapping outlives its descriptor
+    return loaded;
+}
+
+template <typename Scalar>
+bool Dataset<Scalar>::loadText(std::string filename, int descriptor) {
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        std::cerr << "ERROR: could not read data file " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    size_t bytes = status.st_size;
+    if (bytes == 0) return true; // no samples
+    void *text = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (text == MAP_FAILED) {
+        std::cerr << "ERROR: could not map data file " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    madvise(text, bytes, MADV_SEQUENTIAL);
+    
+    // split the file at line ends into chunks, parsed a thread each: a first pass counts every chunk's lines and samples,
+    // which places each chunk's samples in storage laid out for all of them, the second parses them there
+    const char *begin = (const char *)text, *end = begin + bytes;
+    TextJob<Scalar> job;
+    int chunks = (int)std::min<size_t>((bytes + DATASET_PARSE_CHUNK_BYTES - 1) / DATASET_PARSE_CHUNK_BYTES, INT_MAX);
+    for (int c = 0; c < chunks; c++) {
+        TextChunk chunk = {};
+        chunk.begin = job.chunks.empty() ? begin : job.chunks.back().end;
+        const char *split = std::max(chunk.begin, begin + bytes / chunks * (c + 1));
+        const char *newline = c == chunks - 1 ? NULL : (const char *)memchr(split, '\n', end - split);
+        chunk.end = newline ? newline + 1 : end;
+        job.chunks.push_back(chunk);
+        if (chunk.end == end) break;
+    }
+    job.inputCount = inputCount;
+    job.outputCount = outputCount;
+    ThreadPool pool(std::min<int>(job.chunks.size(), ThreadPool::hardwareThreads()), false);
+    job.parse = false;
+    job.next = 0;
+    pool.run(parseTextTask<Scalar>, &job);
+    
+    size_t lines = 1, samples = 0;
+    for (TextChunk &chunk : job.chunks) {
+        chunk.firstLine = lines;
+        chunk.firstSample = samples;
+        lines += chunk.lines;
+        samples += chunk.samples;
+    }
+    bool parsed = samples <= INT_MAX;
+    if (parsed) {
+        inputStorage.resize(samples * inputCount);
+        outputStorage.resize(samples * outputCount);
+        job.inputs = inputStorage.data();
+        job.outputs = outputStorage.data();
+        job.parse = true;
+        job.next = 0;
+        pool.run(parseTextTask<Scalar>, &job);
+        for (const TextChunk &chunk : job.chunks) {
+            if (chunk.errorLine == 0) continue;
+            std::cerr << "ERROR: Invalid data file " << filename << ", line " << chunk.errorLine << " column " << chunk.errorColumn << ": " << chunk.error << std::endl;
+            parsed = false;
+            break;
+        }
+    } else {
+        std::cerr << "ERROR: data file " << filename << " has more samples than fit in an int" << std::endl;
+    }
+    munmap(text, bytes);
+    if (!parsed) {
+        clear();
+        return false;
+    }
+    count = samples;
+    inputs = inputStorage.data();
+    outputs = outputStorage.data();
+    return true;
+}
+
+template <typename Scalar>
+bool Dataset<Scalar>::loadBinary(std::string filename, int descriptor) {
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(DatasetHeader)) {
+        std::cerr << "ERROR: Invalid data file " << filename << "!" << std::endl;
+        return false;
+    }
+    mappingBytes = status.st_size;
+    mapping = mmap(NULL, mappingBytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        std::cerr << "ERROR: could not map data file " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    const DatasetHeader &header = *(const DatasetHeader *)mapping;
+    if (!validHeader(header, mappingBytes)) {
+        std::cerr << "ERROR: Invalid data file " << filename << "!" << std::endl;
+        clear();
+        return false;
+    }
+    if (header.inputCount != inputCount || header.outputCount != outputCount) {
+        std::cerr << "ERROR: data file " << filename << " has " << header.inputCount << " inputs and " << header.outputCount << " outputs, the network " << inputCount << " and " << outputCount << std::endl;
+        clear();
+        return false;
+    }
+    count = header.count;
+    const char *base = (const char *)mapping;
+    if (header.scalarBytes == sizeof(Scalar)) { // read in place
+        inputs = (const Scalar *)(base + header.inputsOffset);
+        outputs = (const Scalar *)(base + header.outputsOffset);
+        madvise(mapping, mappingBytes, MADV_WILLNEED); // training reads every sample, every evaluation
+        return true;
+    }
+
+    // written at the other precision, so converted once
+    if (header.scalarBytes == sizeof(float)) {
+        inputStorage.assign((const float *)(base + header.inputsOffset), (const float *)(base + header.inputsOffset) + (size_t)count * inputCount);
+        outputStorage.assign((const float *)(base + header.outputsOffset), (const float *)(base + header.outputsOffset) + (size_t)count * outputCount);
+    } else {
+        inputStorage.assign((const double *)(base + header.inputsOffset), (const double *)(base + header.inputsOffset) + (size_t)count * inputCount);
+        outputStorage.assign((const double *)(base + header.outputsOffset), (const double *)(base + header.outputsOffset) + (size_t)count * outputCount);
+    }
+    munmap(mapping, mappingBytes);
+    mapping = NULL;
+    mappingBytes = 0;
+    inputs = inputStorage.data();
+    outputs = outputStorage.data();
+    return true;
+}
+
+template <typename Scalar>
+bool Dataset<Scalar>::save(std::string filename) const {
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.scalarBytes = sizeof(Scalar);
+    header.count = count;
+    header.inputCount = inputCount;
+    header.outputCount = outputCount;
+    header.inputsOffset = alignOffset(sizeof(header));
+    header.outputsOffset = alignOffset(header.inputsOffset + (uint64_t)count * inputCount * sizeof(Scalar));
+    header.byteOrder = DATASET_BYTE_ORDER;
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    const char padding[DATASET_ALIGNMENT] = {};
+    out.write((const char *)&header, sizeof(header));
+    out.write(padding, header.inputsOffset - sizeof(header));
+    out.write((const char *)inputs, (size_t)count * inputCount * sizeof(Scalar));
+    out.write(padding, header.outputsOffset - header.inputsOffset - (uint64_t)count * inputCount * sizeof(Scalar));
+    out.write((const char *)outputs, (size_t)count * outputCount * sizeof(Scalar));
+    out.flush();
+    if (!out) {
+        std::cerr << "ERROR: could not write data file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+template <typename Scalar>
+DatasetStream<Scalar>::DatasetStream() : descriptor(-1), count(0), inputCount(0), outputCount(0), chunkSamples(0), chunks(0), front(0), position(0), requested(-1), readFailed(false), stopping(false) {
+    bufferChunk[0] = bufferChunk[1] = -1;
+}
+
+template <typename Scalar>
+DatasetStream<Scalar>::~DatasetStream() {
+    if (loader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        loader.join();
+    }
+    if (descriptor >= 0) close(descriptor);
+}
+
+template <typename Scalar>
+bool DatasetStream<Scalar>::open(std::string filename, int inputs, int outputs, size_t budgetBytes, int granularity) {
+    inputCount = inputs;
+    outputCount = outputs;
+    descriptor = ::open(filename.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0) {
+        std::cerr << "ERROR: could not open data file " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (pread(descriptor, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, DATASET_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << "ERROR: streaming needs a binary data file, " << filename << " is not one (see the convert command)" << std::endl;
+        return false;
+    }
+    if (!validHeader(header, status.st_size) || header.inputCount != inputCount || header.outputCount != outputCount || header.scalarBytes != sizeof(Scalar)) {
+        std::cerr << "ERROR: data file " << filename << " does not match the network's inputs, outputs and precision" << std::endl;
+        return false;
+    }
+    count = header.count;
+    
+    // two buffers' worth of samples fit the budget
+    size_t sampleBytes = (size_t)(inputCount + outputCount) * sizeof(Scalar);
+    size_t fit = std::max<size_t>(1, budgetBytes / (2 * sampleBytes));
+    chunkSamples = (int)std::min<size_t>(std::max(count, 1), fit);
+    if (chunkSamples < count && chunkSamples >= granularity) chunkSamples -= chunkSamples % granularity;
+    chunks = (count + chunkSamples - 1) / chunkSamples;
+    for (int buffer = 0; buffer < 2; buffer++) {
+        inputBuffers[buffer].resize((size_t)chunkSamples * inputCount);
+        outputBuffers[buffer].resize((size_t)chunkSamples * outputCount);
+    }
+    loader = std::thread(&DatasetStream<Scalar>::load, this);
+    return true;
+}
+
+template <typename Scalar>
+int DatasetStream<Scalar>::readChunk(int chunk, int buffer) {
+    size_t first = (size_t)chunk * chunkSamples, samples = std::min<size_t>(chunkSamples, count - first);
+    char *targets[2] = { (char *)inputBuffers[buffer].data(), (char *)outputBuffers[buffer].data() };
+    uint64_t offsets[2] = { header.inputsOffset + first * inputCount * sizeof(Scalar), header.outputsOffset + first * outputCount * sizeof(Scalar) };
+    size_t lengths[2] = { samples * inputCount * sizeof(Scalar), samples * outputCount * sizeof(Scalar) };
+    for (int i = 0; i < 2; i++) {
+        for (size_t done = 0; done < lengths[i]; ) {
+            ssize_t got = pread(descriptor, targets[i] + done, lengths[i] - done, offsets[i] + done);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) return errno;
+            if (got == 0) return -1; // truncated since it was opened
+            done += got;
+        }
+    }
+    return 0;
+}
+
+template <typename Scalar>
+void DatasetStream<Scalar>::load() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || requested >= 0; });
+        if (stopping) return;
+        int chunk = requested, buffer = 1 - front; // front only moves once this chunk is in
+        lock.unlock();
+        int error = readChunk(chunk, buffer);
+        lock.lock();
+        if (error) {
+            std::cerr << "ERROR: could not read samples from the data file: " << (error < 0 ? "it ends before its last sample" : strerror(error)) << std::endl;
+            readFailed = true;
+        }
+        bufferChunk[buffer] = error ? -1 : chunk;
+        requested = -1;
+        changed.notify_all();
+    }
+}
+
+template <typename Scalar>
+void DatasetStream<Scalar>::request(std::unique_lock<std::mutex> &lock, int chunk) {
+    if (bufferChunk[front] == chunk || bufferChunk[1 - front] == chunk) return;
+    changed.wait(lock, [&] { return requested < 0; }); // the loader reads one chunk at a time
+    bufferChunk[1 - front] = -1;
+    requested = chunk;
+    changed.notify_all();
+}
+
+template <typename Scalar>
+bool DatasetStream<Scalar>::next(const Scalar *&inputs, const Scalar *&outputs, int &samples) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (position == chunks || readFailed) {
+        position = 0;
+        return false;
+    }
+    if (bufferChunk[front] != position) { // move to the back buffer once the loader has it
+        request(lock, position);
+        changed.wait(lock, [&] { return bufferChunk[1 - front] == position || readFailed; });
+        if (readFailed) return false;
+        front = 1 - front;
+    }
+    inputs = inputBuffers[front].data();
+    outputs = outputBuffers[front].data();
+    samples = std::min(chunkSamples, count - position * chunkSamples);
+    
+    // read ahead while this chunk is used, past the last chunk the first one again for the next pass
+    position++;
+    request(lock, position < chunks ? position : 0);
+    return true;
+}
+
+template <typename Scalar>
+bool DatasetStream<Scalar>::failed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return readFailed;
+}
+
+
+template class Dataset<float>;
+template class Dataset<double>;
+template class DatasetStream<float>;
+template class DatasetStream<double>;
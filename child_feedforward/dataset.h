@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "utils.h"
+
+#define DATASET_MAGIC "ENNDATA" ///< the first eight bytes of a binary data file, terminator included
+#define DATASET_VERSION 2
+#define DATASET_BYTE_ORDER 0x0102030405060708ULL ///< reads as another value on a machine of the other byte order
+#define DATASET_ALIGNMENT CACHE_LINE_SIZE ///< the input and output arrays of a binary data file start on a multiple of this
+#define DATASET_PARSE_CHUNK_BYTES (1024 * 1024) ///< a text data file is split into chunks of about this much, parsed in parallel
+
+/// DatasetHeader starts a binary data file. The inputs of every sample follow it as one row-major count x inputCount array
+/// and the outputs as another, each starting on a DATASET_ALIGNMENT boundary, in the byte order of the machine that wrote it
+/// (byteOrder tells a file from a machine of the other byte order apart, which is rejected).
+struct DatasetHeader {
+    char magic[8]; ///< DATASET_MAGIC
+    uint32_t version; ///< DATASET_VERSION
+    uint32_t scalarBytes; ///< 4 for float values, 8 for double
+    uint64_t count; ///< samples
+    uint32_t inputCount;
+    uint32_t outputCount;
+    uint64_t inputsOffset; ///< from the start of the file
+    uint64_t outputsOffset;
+    uint64_t byteOrder; ///< DATASET_BYTE_ORDER
+};
+
+/// Dataset is a read-only set of supervised samples, loaded from either kind of data file: a text file of "inputs : outputs"
+/// lines (lines starting with # are comments) is parsed into memory across every CPU, a binary one (see DatasetHeader) written at the same
+/// precision is mapped, so its samples are used where they lie in the page cache without parsing or copying. Forked worker
+/// processes share the mapping.
+template <typename Scalar>
+class Dataset {
+    std::vector<Scalar> inputStorage, outputStorage; ///< the samples of a parsed text file, or of a binary one converted to Scalar
+    void *mapping; ///< the binary file mapped read-only, NULL when the samples live in the storage above
+    size_t mappingBytes;
+    const Scalar *inputs;
+    const Scalar *outputs;
+    int count;
+    int inputCount;
+    int outputCount;
+
+    bool loadText(std::string filename, int descriptor);
+    bool loadBinary(std::string filename, int descriptor);
+    void clear();
+
+public:
+    Dataset();
+    ~Dataset();
+    Dataset(const Dataset &) = delete;
+    Dataset &operator=(const Dataset &) = delete;
+
+    /// loads a data file of samples with the given number of inputs and outputs, telling the kind from its first bytes. Fails,
+    /// printing why, when the file cannot be read or does not match, naming the line and column of a malformed text line.
+    bool load(std::string filename, int inputCount, int outputCount);
+    bool isMapped() const { return mapping != NULL; }
+
+    int size() const { return count; }
+    Span<const Scalar> getInputs() const { return Span<const Scalar>(inputs, (size_t)count * inputCount); } ///< row-major, a sample per row
+    Span<const Scalar> getOutputs() const { return Span<const Scalar>(outputs, (size_t)count * outputCount); }
+
+    /// writes the samples as a binary data file at this precision, fails when the file cannot be written
+    bool save(std::string filename) const;
+};
+
+/// DatasetStream reads a binary data file a chunk of samples at a time, for sets larger than memory: a background thread
+/// reads the next chunk into one buffer while the current one is used from the other, so at most two chunks are in memory.
+/// Chunks are handed out in order, and reading one past the end starts the next pass. A set that fits in the two buffers
+/// is read only once.
+template <typename Scalar>
+class DatasetStream {
+    int descriptor;
+    DatasetHeader header;
+    int count;
+    int inputCount;
+    int outputCount;
+    int chunkSamples;
+    int chunks;
+    AlignedVector<Scalar> inputBuffers[2], outputBuffers[2];
+    int bufferChunk[2]; ///< the chunk each buffer holds, -1 while empty or being filled
+    int front; ///< the buffer next() last handed out, the loader fills the other
+    int position; ///< the chunk next() hands out next
+    
+    std::thread loader;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    int requested; ///< the chunk the loader is to read into the back buffer, -1 when it is idle
+    bool readFailed;
+    bool stopping;
+    
+    void load(); ///< the loader's loop
+    int readChunk(int chunk, int buffer); ///< reads a chunk with pread, returns 0, the errno it failed with or -1 when the file ends early
+    void request(std::unique_lock<std::mutex> &lock, int chunk); ///< has the loader read chunk into the back buffer unless either buffer holds it
+    
+public:
+    DatasetStream();
+    ~DatasetStream();
+    DatasetStream(const DatasetStream &) = delete;
+    DatasetStream &operator=(const DatasetStream &) = delete;
+    
+    /// opens a binary data file written at this precision with the given number of inputs and outputs, sizing the two chunk
+    /// buffers to fit budgetBytes (chunks are a multiple of granularity samples when the budget allows); fails, printing why,
+    /// when the file cannot be read or does not match
+    bool open(std::string filename, int inputCount, int outputCount, size_t budgetBytes, int granularity);
+    int size() const { return count; }
+    int getChunkSamples() const { return chunkSamples; }
+    
+    /// hands out the next chunk of samples, row-major, valid until the following call; returns false after the last chunk of a
+    /// pass (the next call starts over) or when reading failed, which failed() tells apart
+    bool next(const Scalar *&inputs, const Scalar *&outputs, int &samples);
+    
+    /// true once a chunk could not be read, every later next() returns false at once
+    bool failed() const;
+};
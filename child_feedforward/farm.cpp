@@ -0,0 +1,219 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "farm.h"
+
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#ifdef MSG_NOSIGNAL
+#define FARM_SEND_FLAGS MSG_NOSIGNAL // a dead worker is an error code, not a SIGPIPE
+#else
+#define FARM_SEND_FLAGS 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+/// writes all of data, fails once the other end is gone
+static bool sendAll(int socket, const void *data, size_t bytes) {
+    const char *next = (const char *)data;
+    while (bytes > 0) {
+        ssize_t sent = send(socket, next, bytes, FARM_SEND_FLAGS);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        next += sent;
+        bytes -= sent;
+    }
+    return true;
+}
+
+/// reads exactly bytes into data, fails once the other end is gone
+static bool receiveAll(int socket, void *data, size_t bytes) {
+    char *next = (char *)data;
+    while (bytes > 0) {
+        ssize_t received = recv(socket, next, bytes, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        next += received;
+        bytes -= received;
+    }
+    return true;
+}
+
+WorkerFarm::WorkerFarm(int count, size_t chromosomeBytes, Evaluator evaluator) : chromosomeBytes(chromosomeBytes), evaluator(evaluator), restarts(0) {
+    workers.resize(std::max(1, count));
+    for (Worker &worker : workers) worker.pid = -1;
+    for (Worker &worker : workers) {
+        if (!spawn(worker)) std::cerr << "ERROR: could not start a training worker: " << strerror(errno) << std::endl;
+    }
+}
+
+WorkerFarm::~WorkerFarm() {
+    for (Worker &worker : workers) retire(worker, false);
+}
+
+bool WorkerFarm::spawn(Worker &worker) {
+    worker.pid = -1;
+    worker.batch = -1;
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+    timeval timeout = { FARM_BATCH_TIMEOUT_SECONDS, 0 }; // a worker that stops partway through an answer counts as hung too
+    setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    setsockopt(sockets[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    std::cout.flush(); // or the worker inherits whatever is buffered
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0) { // the worker: drop the master's end of every socket, so each worker sees its own hang up
+        close(sockets[0]);
+        for (Worker &other : workers) {
+            if (other.pid > 0) close(other.socket);
+        }
+        serve(sockets[1], chromosomeBytes, evaluator);
+    }
+    close(sockets[1]);
+    worker.pid = pid;
+    worker.socket = sockets[0];
+    return true;
+}
+
+void WorkerFarm::retire(Worker &worker, bool crashed) {
+    if (worker.pid <= 0) return;
+    close(worker.socket); // a live worker reads the hang up and exits
+    if (crashed) kill(worker.pid, SIGKILL); // in case it only stopped answering
+    while (waitpid(worker.pid, NULL, 0) < 0 && errno == EINTR);
+    worker.pid = -1;
+    worker.batch = -1;
+}
+
+void WorkerFarm::serve(int socket, size_t chromosomeBytes, const Evaluator &evaluator) {
+    std::vector<char> genes, exact;
+    std::vector<double> fitness;
+    FarmBatch batch;
+    while (receiveAll(socket, &batch, sizeof(batch))) {
+        genes.resize(batch.count * chromosomeBytes);
+        fitness.resize(batch.count);
+        exact.resize(batch.count);
+        if (!receiveAll(socket, genes.data(), genes.size())) break;
+
+        FarmResult result;
+        result.count = batch.count;
+        result.samples = evaluator(genes.data(), batch.count, batch.cutoff, fitness.data(), exact.data());
+        if (!sendAll(socket, &result, sizeof(result)) || !sendAll(socket, fitness.data(), fitness.size() * sizeof(double)) || !sendAll(socket, exact.data(), exact.size())) break;
+    }
+    _exit(0); // skip the master's destructors and atexit handlers, they are not ours to run
+}
+
+void WorkerFarm::replace(Worker &worker, std::vector<int> &queue, const char *what) {
+    std::cerr << "Training worker " << worker.pid << " " << what << ", requeueing its batch of " << worker.count << std::endl;
+    queue.push_back(worker.batch);
+    retire(worker, true);
+    if (spawn(worker)) restarts++;
+    else std::cerr << "ERROR: could not replace the training worker: " << strerror(errno) << std::endl;
+}
+
+int WorkerFarm::size() const {
+    int live = 0;
+    for (const Worker &worker : workers) live += worker.pid > 0;
+    return live;
+}
+
+uint64_t WorkerFarm::evaluate(const std::vector<const char *> &chromosomes, double cutoff, double *fitness, char *exact) {
+    int count = chromosomes.size();
+    if (count == 0) return 0;
+
+    // batches are handed out first come first served, a dead worker's goes back on the queue
+    int batchSize = std::max<int>(1, (count + workers.size() * FARM_BATCHES_PER_WORKER - 1) / (workers.size() * FARM_BATCHES_PER_WORKER));
+    std::vector<int> queue;
+    for (int first = 0; first < count; first += batchSize) queue.push_back(first);
+    int outstanding = queue.size();
+    uint64_t samples = 0;
+    std::vector<pollfd> polls;
+    std::vector<Worker *> polled;
+
+    while (outstanding > 0) {
+        // give every idle worker the next batch
+        for (Worker &worker : workers) {
+            if (worker.pid <= 0 || worker.batch >= 0 || queue.empty()) continue;
+            worker.batch = queue.back();
+            worker.count = std::min(batchSize, count - worker.batch);
+            queue.pop_back();
+
+            FarmBatch batch = { (uint32_t)worker.count, cutoff };
+            message.resize(sizeof(batch) + worker.count * chromosomeBytes);
+            memcpy(message.data(), &batch, sizeof(batch));
+            for (int i = 0; i < worker.count; i++) memcpy(message.data() + sizeof(batch) + i * chromosomeBytes, chromosomes[worker.batch + i], chromosomeBytes);
+            sendAll(worker.socket, message.data(), message.size()); // a worker that died since its last batch hangs up in the poll below and is replaced there
+            worker.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(FARM_BATCH_TIMEOUT_SECONDS);
+        }
+
+        // nobody left to hand batches to, finish here
+        if (size() == 0) {
+            for (int first : queue) {
+                int batch = std::min(batchSize, count - first);
+                std::vector<char> genes(batch * chromosomeBytes);
+                for (int i = 0; i < batch; i++) memcpy(genes.data() + i * chromosomeBytes, chromosomes[first + i], chromosomeBytes);
+                samples += evaluator(genes.data(), batch, cutoff, fitness + first, exact + first);
+                outstanding--;
+            }
+            queue.clear();
+            break;
+        }
+
+        // wait for any busy worker to answer or hang up, until the first deadline
+        polls.clear();
+        polled.clear();
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(), deadline = std::chrono::steady_clock::time_point::max();
+        for (Worker &worker : workers) {
+            if (worker.pid <= 0 || worker.batch < 0) continue;
+            pollfd entry = { worker.socket, POLLIN, 0 };
+            polls.push_back(entry);
+            polled.push_back(&worker);
+            deadline = std::min(deadline, worker.deadline);
+        }
+        int wait = (int)std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1);
+        if (poll(polls.data(), polls.size(), wait) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "ERROR: lost track of the training workers, scoring in this process from now on: " << strerror(errno) << std::endl;
+            for (Worker &worker : workers) { // their batches go back on the queue for the fallback above
+                if (worker.batch >= 0) queue.push_back(worker.batch);
+                retire(worker, true);
+            }
+            continue;
+        }
+        now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < polls.size(); i++) {
+            Worker &worker = *polled[i];
+            if (!polls[i].revents) {
+                if (now >= worker.deadline) replace(worker, queue, "hung");
+                continue;
+            }
+            FarmResult result;
+            bool answered = receiveAll(worker.socket, &result, sizeof(result)) && result.count == (uint32_t)worker.count
+                && receiveAll(worker.socket, fitness + worker.batch, worker.count * sizeof(double))
+                && receiveAll(worker.socket, exact + worker.batch, worker.count);
+            if (answered) {
+                samples += result.samples;
+                outstanding--;
+                worker.batch = -1;
+            } else { // gone or garbled, either way its batch is scored again elsewhere
+                replace(worker, queue, "died");
+            }
+        }
+    }
+    return samples;
+}
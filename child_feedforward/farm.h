@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FARM_BATCHES_PER_WORKER 4 ///< a generation is split into about this many batches per worker, so faster workers take more
+#define FARM_BATCH_TIMEOUT_SECONDS 600 ///< a worker silent this long on one batch is taken for hung, killed and replaced
+
+/// FarmBatch starts every message from the master to a worker, the batch's genes follow it raw, chromosome after chromosome
+struct FarmBatch {
+    uint32_t count; ///< chromosomes in the batch
+    double cutoff; ///< as FitnessJob::cutoff
+};
+
+/// FarmResult starts every reply, count fitness doubles and count exact flags (one byte each) follow it
+struct FarmResult {
+    uint32_t count;
+    uint64_t samples; ///< training samples the batch was evaluated on, over every chromosome
+};
+
+/// WorkerFarm scores chromosomes in worker processes forked from this one, so every worker starts with the network and
+/// training data as they are, without loading anything or sharing an allocator with the master. Each worker talks to the
+/// master over its own Unix domain socket: the master hands out batches as workers become idle, and a worker that dies or
+/// hangs has its batch queued again and is replaced by a new fork. Not thread safe, evaluate() is called by one thread at a
+/// time.
+class WorkerFarm {
+public:
+    /// scores count chromosomes laid back to back against cutoff, filling in a fitness and an exact flag for each (clear when
+    /// the evaluation stopped early), returns the training samples evaluated. Runs in the workers.
+    typedef std::function<uint64_t(const char *chromosomes, int count, double cutoff, double *fitness, char *exact)> Evaluator;
+
+private:
+    struct Worker {
+        pid_t pid; ///< -1 once the worker could not be replaced
+        int socket; ///< the master's end
+        int batch; ///< the first chromosome of the batch it is scoring, -1 when idle
+        int count;
+        std::chrono::steady_clock::time_point deadline; ///< when a busy worker is given up on
+    };
+    std::vector<Worker> workers;
+    size_t chromosomeBytes;
+    Evaluator evaluator;
+    std::vector<char> message; ///< a batch being sent, reused
+    long restarts;
+
+    bool spawn(Worker &worker); ///< forks a new worker process, fails when fork or socketpair does
+    void retire(Worker &worker, bool crashed); ///< closes the socket and reaps the process, killing it first if it misbehaved
+    void replace(Worker &worker, std::vector<int> &queue, const char *what); ///< requeues a worker's batch and forks a new one in place of it
+    static void serve(int socket, size_t chromosomeBytes, const Evaluator &evaluator); ///< a worker's loop, exits the process once the master hangs up
+
+public:
+    WorkerFarm(int workers, size_t chromosomeBytes, Evaluator evaluator); ///< forks the workers, chromosomes are chromosomeBytes of genes each
+    ~WorkerFarm(); ///< hangs up on every worker and waits for it to exit
+
+    int size() const; ///< live workers
+    long getRestarts() const { return restarts; } ///< workers replaced after dying
+
+    /// scores every chromosome across the workers, writing fitness[i] and exact[i] for chromosomes[i]; returns the training
+    /// samples evaluated. Should every worker die and fork fail, or the workers become impossible to wait on, the remaining
+    /// chromosomes are scored in this process.
+    uint64_t evaluate(const std::vector<const char *> &chromosomes, double cutoff, double *fitness, char *exact);
+};
@@ -4,100 +4,405 @@
 
 #include "genetic.h"
 #include "utils.h"
+#include <string.h>
+#include <functional>
 
 
-const double Genetic::maximumMutation = 0.3;
-const int Genetic::numberEliteCopies = 1;
-const int Genetic::numberElite = 4;
+static const char *selectionNames[SELECTION_MODES] = { "roulette", "alias", "universal", "tournament", "truncation" };
 
-Genetic::Genetic(int populationSize, double mutationRate, double crossoverRate, int chromosomeLength) :
+const char *selectionName(Selection mode) {
+    return selectionNames[mode];
+}
+
+bool selectionFromName(std::string name, Selection &mode) {
+    for (int i = 0; i < SELECTION_MODES; i++) {
+        if (name == selectionNames[i]) {
+            mode = (Selection)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *crossoverNames[CROSSOVER_MODES] = { "single", "two", "uniform", "arithmetic", "blend", "neuron" };
+
+const char *crossoverName(Crossover mode) {
+    return crossoverNames[mode];
+}
+
+bool crossoverFromName(std::string name, Crossover &mode) {
+    for (int i = 0; i < CROSSOVER_MODES; i++) {
+        if (name == crossoverNames[i]) {
+            mode = (Crossover)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *migrationNames[MIGRATION_MODES] = { "ring", "random" };
+
+const char *migrationName(Migration mode) {
+    return migrationNames[mode];
+}
+
+bool migrationFromName(std::string name, Migration &mode) {
+    for (int i = 0; i < MIGRATION_MODES; i++) {
+        if (name == migrationNames[i]) {
+            mode = (Migration)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+template <typename Scalar>
+const double Genetic<Scalar>::maximumMutation = 0.3;
+template <typename Scalar>
+const int Genetic<Scalar>::numberEliteCopies;
+template <typename Scalar>
+const int Genetic<Scalar>::numberElite;
+
+template <typename Scalar>
+Genetic<Scalar>::Genetic(int populationSize, double mutationRate, double crossoverRate, int chromosomeLength, uint64_t seed, uint64_t stream) :
+random(seed, stream),
+cutoffPercentile(-1),
+percentileCutoff(-INFINITY),
+selection(SelectionRoulette),
+selectionSize(2),
+selectedNext(0),
+crossoverMode(CrossoverSinglePoint),
+blendAlpha(0.5),
+numberOfGroups(0),
 populationSize(populationSize),
-mutationRate(mutationRate),
-crossoverRate(crossoverRate),
 chromosomeLength(chromosomeLength),
 totalFitness(0),
-generation(0),
-bestChromosome(0),
 bestFitness(0),
+averageFitness(0),
 worstFitness(99999999),
-averageFitness(0) {
+bestChromosome(0),
+mutationRate(mutationRate),
+crossoverRate(crossoverRate),
+generation(0) {
+    current = 0;
+    genes[0].resize((size_t)populationSize * chromosomeLength);
+    genes[1].resize((size_t)populationSize * chromosomeLength);
+    fitness.resize(populationSize, 0);
+    nextFitness.resize(populationSize, 0);
+    stale.resize(populationSize, true);
+    nextStale.resize(populationSize, true);
+    ranking.resize(populationSize);
+    for (int i = 0; i < populationSize; i++) ranking[i] = i;
+    cumulativeFitness.resize(populationSize);
+    aliasProbability.resize(populationSize);
+    aliasIndex.resize(populationSize);
+    selected.resize(populationSize);
+    
+    draws.resize(3 * GENETIC_MASK_BLOCK);
+    crossoverDraws.resize(2 * GENETIC_MASK_BLOCK);
+    spare.resize(chromosomeLength);
+    
     // create random chromosomes with zero fitness
-    for (int i = 0; i < populationSize; i++) {
-		population.push_back(Chromosome());
-		for (int j = 0; j < chromosomeLength; j++) {
-			population[i].genes.push_back(randomClamped());
-		}
-	}
+    Scalar *gene = genes[current].data();
+    for (size_t remaining = genes[current].size(); remaining > 0; ) {
+        size_t count = std::min<size_t>(GENETIC_MASK_BLOCK, remaining);
+        random.fill(draws.data(), 2 * count);
+        for (size_t j = 0; j < count; j++) *gene++ = draws[j] - draws[count + j]; // as randomClamped()
+        remaining -= count;
+    }
 }
 
 
-void Genetic::mutate(std::vector<double> &chromosome) {
-    for (int i = 0; i < chromosome.size(); i++) {
-        if (randFloat() < mutationRate) { // should this gene be mutated
-            chromosome[i] += randomClamped() * maximumMutation;
+template <typename Scalar>
+int Genetic<Scalar>::mutate(Scalar *chromosome) {
+    int mutated = 0;
+    if (mutationRate <= GENETIC_SKIP_MAX_RATE) { // jump straight from one mutated gene to the next
+        double logKeep = log(1 - mutationRate);
+        for (long i = random.geometric(logKeep); i < chromosomeLength; i += 1 + (long)random.geometric(logKeep)) {
+            chromosome[i] += random.clamped() * maximumMutation;
+            mutated++;
+        }
+    } else { // a bulk drawn mask and amounts, blended in without branches
+        for (int begin = 0; begin < chromosomeLength; begin += GENETIC_MASK_BLOCK) {
+            int count = std::min(GENETIC_MASK_BLOCK, chromosomeLength - begin);
+            random.fill(draws.data(), 3 * count);
+            const double *mask = draws.data(), *first = mask + count, *second = first + count;
+            for (int i = 0; i < count; i++) {
+                bool mutate = mask[i] < mutationRate; // should this gene be mutated
+                chromosome[begin + i] += mutate ? (Scalar)((first[i] - second[i]) * maximumMutation) : 0;
+                mutated += mutate;
+            }
         }
     }
+    return mutated;
 }
 
-Chromosome Genetic::getChromosomeRoulette() {
-    double slice = (double)(randFloat() * totalFitness);
-    Chromosome c;
-    double cumulativeFitness = 0;
-    for (int i = 0; i < populationSize; i++) {
-        cumulativeFitness += population[i].fitness;
-        if (cumulativeFitness >= slice) {
-            c = population[i];
-            break;
+template <typename Scalar>
+void Genetic<Scalar>::setSelection(Selection mode, int size) {
+    selection = mode;
+    selectionSize = std::max(1, size);
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::prepareSelection() {
+    if (selection == SelectionRoulette) {
+        double sum = 0;
+        for (int i = 0; i < populationSize; i++) cumulativeFitness[i] = sum += fitness[i];
+    } else if (selection == SelectionAlias) { // Vose's construction: pair every underfull slot with an overfull chromosome
+        int smallCount = 0, largeStart = populationSize; // selected is free scratch space here: underfull slots stack up from the front, overfull from the back
+        for (int i = 0; i < populationSize; i++) {
+            aliasProbability[i] = totalFitness > 0 ? fitness[i] * populationSize / totalFitness : 1; // no fitness yet, every chromosome equally
+            aliasIndex[i] = i;
+            if (aliasProbability[i] < 1) selected[smallCount++] = i;
+            else selected[--largeStart] = i;
+        }
+        while (smallCount > 0 && largeStart < populationSize) {
+            int under = selected[--smallCount], over = selected[largeStart];
+            aliasIndex[under] = over;
+            aliasProbability[over] -= 1 - aliasProbability[under];
+            if (aliasProbability[over] < 1) selected[smallCount++] = selected[largeStart++]; // now underfull itself
         }
+        while (smallCount > 0) aliasProbability[selected[--smallCount]] = 1; // only rounding left these short
+    } else if (selection == SelectionUniversal) {
+        double spacing = totalFitness / populationSize;
+        double pointer = random.uniform() * spacing, cumulative = 0;
+        for (int i = 0, picked = 0; i < populationSize && picked < populationSize; i++) {
+            cumulative += fitness[i];
+            while (picked < populationSize && (pointer < cumulative || i == populationSize - 1)) { // the last chromosome absorbs rounding
+                selected[picked++] = totalFitness > 0 ? i : random.range(0, populationSize - 1);
+                pointer += spacing;
+            }
+        }
+        for (int i = populationSize - 1; i > 0; i--) std::swap(selected[i], selected[random.range(0, i)]); // so parents are not paired with their neighbours
+        selectedNext = 0;
+    } else if (selection == SelectionTruncation) { // fitness breaks no ties and the order is by index, so the picks depend only on which chromosomes these are
+        int candidates = std::min(selectionSize, populationSize);
+        for (int i = 0; i < populationSize; i++) selected[i] = i;
+        std::nth_element(selected.begin(), selected.begin() + candidates - 1, selected.end(), [&](int a, int b) { return fitness[a] > fitness[b] || (fitness[a] == fitness[b] && a < b); });
+        std::sort(selected.begin(), selected.begin() + candidates);
+    }
+}
+
+template <typename Scalar>
+int Genetic<Scalar>::selectChromosome() {
+    switch (selection) {
+        case SelectionRoulette: { // the first chromosome whose running sum reaches the slice
+            double slice = (double)(random.uniform() * totalFitness);
+            return std::min<int>(populationSize - 1, std::lower_bound(cumulativeFitness.begin(), cumulativeFitness.end(), slice) - cumulativeFitness.begin());
+        }
+        case SelectionAlias: {
+            int slot = random.range(0, populationSize - 1);
+            return random.uniform() < aliasProbability[slot] ? slot : aliasIndex[slot];
+        }
+        case SelectionUniversal: {
+            if (selectedNext == populationSize) selectedNext = 0; // elitism leaves the spin a few picks spare, this never wraps in practice
+            return selected[selectedNext++];
+        }
+        case SelectionTruncation:
+            return selected[random.range(0, std::min(selectionSize, populationSize) - 1)];
+        default: {
+            int best = random.range(0, populationSize - 1);
+            for (int i = 1; i < selectionSize; i++) {
+                int contender = random.range(0, populationSize - 1);
+                if (fitness[contender] > fitness[best]) best = contender;
+            }
+            return best;
+        }
+    }
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::setCrossover(Crossover mode, double alpha) {
+    crossoverMode = mode;
+    blendAlpha = alpha;
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::setGeneGroups(const std::vector<int> &groups) {
+    geneGroups = groups;
+    numberOfGroups = groups.empty() ? 0 : *std::max_element(groups.begin(), groups.end()) + 1;
+    if (crossoverDraws.size() < numberOfGroups) crossoverDraws.resize(numberOfGroups);
+}
+
+/// progeny1 takes genes1[i] where take2[i] is false and genes2[i] where it is true, progeny2 the opposite, written as a
+/// select so it compiles to vector blends
+template <typename Scalar, typename Mask>
+static inline void blendGenes(const Scalar *genes1, const Scalar *genes2, Scalar *progeny1, Scalar *progeny2, int count, Mask take2) {
+    for (int i = 0; i < count; i++) {
+        bool swap = take2(i);
+        progeny1[i] = swap ? genes2[i] : genes1[i];
+        progeny2[i] = swap ? genes1[i] : genes2[i];
     }
-    return c;
 }
 
-void Genetic::crossover(const std::vector<double> &progenitor1, const std::vector<double> &progenitor2, std::vector<double> &progeny1, std::vector<double> &progeny2) {
-    if (randFloat() > crossoverRate || progenitor1 == progenitor2) { // if we are not doing crossover or progenitor chromosomes are the same
-        progeny1 = progenitor1;
-        progeny2 = progenitor2;
-    } else { // crossover
-        int crossoverPoint = randInt(0, chromosomeLength - 1);
-        for (int i = 0; i < crossoverPoint; i++) {
-            progeny1.push_back(progenitor1[i]);
-            progeny2.push_back(progenitor2[i]);
+template <typename Scalar>
+bool Genetic<Scalar>::crossover(int progenitor1, int progenitor2, Scalar *progeny1, Scalar *progeny2) {
+    const Scalar *genes1 = row(current, progenitor1), *genes2 = row(current, progenitor2);
+    const size_t bytes = chromosomeLength * sizeof(Scalar);
+    if (random.uniform() > crossoverRate || progenitor1 == progenitor2) { // if we are not doing crossover or progenitor chromosomes are the same
+        memcpy(progeny1, genes1, bytes);
+        memcpy(progeny2, genes2, bytes);
+        return false;
+    }
+    
+    Crossover mode = crossoverMode;
+    if (mode == CrossoverNeuron && geneGroups.size() != chromosomeLength) mode = CrossoverUniform; // no grouping given, every gene is its own
+    switch (mode) {
+        case CrossoverSinglePoint:
+        case CrossoverTwoPoint: { // copy each parent whole, then trade the run between the points
+            int begin = random.range(0, chromosomeLength - 1), end = chromosomeLength;
+            if (mode == CrossoverTwoPoint) {
+                end = random.range(0, chromosomeLength - 1);
+                if (end < begin) std::swap(begin, end);
+            }
+            memcpy(progeny1, genes1, bytes);
+            memcpy(progeny2, genes2, bytes);
+            memcpy(progeny1 + begin, genes2 + begin, (end - begin) * sizeof(Scalar));
+            memcpy(progeny2 + begin, genes1 + begin, (end - begin) * sizeof(Scalar));
+            break;
         }
-        for (int i = crossoverPoint; i < progenitor1.size(); i++) {
-            progeny1.push_back(progenitor1[i]);
-            progeny2.push_back(progenitor2[i]);
+        case CrossoverUniform:
+            for (int begin = 0; begin < chromosomeLength; begin += GENETIC_MASK_BLOCK) {
+                int count = std::min(GENETIC_MASK_BLOCK, chromosomeLength - begin);
+                random.fill(crossoverDraws.data(), count);
+                const Scalar *mask = crossoverDraws.data();
+                blendGenes(genes1 + begin, genes2 + begin, progeny1 + begin, progeny2 + begin, count, [&](int i) { return mask[i] < (Scalar)0.5; });
+            }
+            break;
+        case CrossoverArithmetic: {
+            Scalar weight = random.uniform();
+            for (int i = 0; i < chromosomeLength; i++) {
+                progeny1[i] = weight * genes1[i] + (1 - weight) * genes2[i];
+                progeny2[i] = (1 - weight) * genes1[i] + weight * genes2[i];
+            }
+            break;
+        }
+        case CrossoverBlend: { // lowest + u * (1 + 2 alpha) * distance, u drawn independently for each offspring
+            const Scalar alpha = blendAlpha, reach = 1 + 2 * blendAlpha;
+            for (int begin = 0; begin < chromosomeLength; begin += GENETIC_MASK_BLOCK) {
+                int count = std::min(GENETIC_MASK_BLOCK, chromosomeLength - begin);
+                random.fill(crossoverDraws.data(), 2 * count);
+                const Scalar *first = crossoverDraws.data(), *second = first + count;
+                for (int i = 0; i < count; i++) {
+                    Scalar a = genes1[begin + i], b = genes2[begin + i];
+                    Scalar low = std::min(a, b), distance = std::max(a, b) - low;
+                    progeny1[begin + i] = low + (first[i] * reach - alpha) * distance;
+                    progeny2[begin + i] = low + (second[i] * reach - alpha) * distance;
+                }
+            }
+            break;
         }
+        case CrossoverNeuron: { // one coin per group, every gene follows its group's
+            random.fill(crossoverDraws.data(), numberOfGroups);
+            const Scalar *coins = crossoverDraws.data();
+            const int *groups = geneGroups.data();
+            blendGenes(genes1, genes2, progeny1, progeny2, chromosomeLength, [&](int i) { return coins[groups[i]] < (Scalar)0.5; });
+            break;
+        }
+        default:
+            break;
     }
+    return true;
 }
 
-void Genetic::takeBest(int num, const int numcopies, std::vector<Chromosome> &pop) {
+template <typename Scalar>
+int Genetic<Scalar>::takeBest(int num, const int numcopies) {
+    int written = 0;
+    num = std::min(num, populationSize / numcopies);
     while (num--) {
         for (int i = 0; i < numcopies; i++) {
-            pop.push_back(population[(populationSize - 1) - num]);
+            int elite = ranking[(populationSize - 1) - num];
+            memcpy(row(1 - current, written), row(current, elite), chromosomeLength * sizeof(Scalar));
+            inherit(written++, elite, false);
         }
     }
+    return written;
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::inherit(int progeny, int progenitor, bool changed) {
+    nextFitness[progeny] = changed ? 0 : fitness[progenitor];
+    nextStale[progeny] = changed || stale[progenitor];
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::invalidateFitness() {
+    std::fill(stale.begin(), stale.end(), true);
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::copyFittest(int count, Scalar *chromosomes, double *fitnesses, char *exact) {
+    count = std::min(count, populationSize);
+    std::nth_element(ranking.begin(), ranking.end() - count, ranking.end(), [&](int a, int b) { return fitness[a] < fitness[b]; }); // ranking is rebuilt by the next calculateFitnessMetrics()
+    for (int i = 0; i < count; i++) {
+        int chromosome = ranking[populationSize - count + i];
+        memcpy(chromosomes + (size_t)i * chromosomeLength, row(current, chromosome), chromosomeLength * sizeof(Scalar));
+        fitnesses[i] = fitness[chromosome];
+        exact[i] = !stale[chromosome];
+    }
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::replaceWeakest(int count, const Scalar *chromosomes, const double *fitnesses, const char *exact) {
+    count = std::min(count, populationSize);
+    std::nth_element(ranking.begin(), ranking.begin() + count, ranking.end(), [&](int a, int b) { return fitness[a] < fitness[b]; });
+    for (int i = 0; i < count; i++) {
+        int chromosome = ranking[i];
+        memcpy(row(current, chromosome), chromosomes + (size_t)i * chromosomeLength, chromosomeLength * sizeof(Scalar));
+        fitness[chromosome] = fitnesses[i];
+        stale[chromosome] = !exact[i];
+    }
+}
+
+template <typename Scalar>
+double Genetic<Scalar>::getEliteCutoff() const {
+    int needed = numberEliteCopies * numberElite % 2 ? 0 : numberElite; // no elitism, see runEpoch()
+    if (selection == SelectionTruncation) needed = std::max(needed, std::min(selectionSize, populationSize));
+    if (needed == 0) return -INFINITY;
+    std::vector<double> known; // once a generation, the allocation does not matter
+    for (int i = 0; i < populationSize; i++) {
+        if (!stale[i]) known.push_back(fitness[i]);
+    }
+    if ((int)known.size() < needed) return -INFINITY;
+    std::nth_element(known.begin(), known.begin() + needed - 1, known.end(), std::greater<double>());
+    return known[needed - 1];
+}
+
+template <typename Scalar>
+void Genetic<Scalar>::setCutoffPercentile(double percentile) {
+    cutoffPercentile = percentile;
+    percentileCutoff = -INFINITY;
 }
 
-void Genetic::calculateFitnessMetrics() {
+template <typename Scalar>
+void Genetic<Scalar>::calculateFitnessMetrics() {
+    // only the elite need ordering: partition them to the end, then sort just those. Ties go to the lower index, so the
+    // order does not depend on the fitness of chromosomes outside the elite.
+    auto fitter = [&](int a, int b) { return fitness[a] < fitness[b] || (fitness[a] == fitness[b] && a > b); };
+    int elite = std::min(numberElite, populationSize);
+    std::nth_element(ranking.begin(), ranking.end() - elite, ranking.end(), fitter);
+    std::sort(ranking.end() - elite, ranking.end(), fitter);
     totalFitness = 0;
     double highestSoFar = 0;
     double lowestSoFar = 99999999;
     for (int i = 0; i < populationSize; i++) {
-        if (population[i].fitness > highestSoFar) { // better chromosome
-            highestSoFar = population[i].fitness;
+        if (fitness[i] > highestSoFar) { // better chromosome
+            highestSoFar = fitness[i];
             bestChromosome = i;
             bestFitness = highestSoFar;
         }
-        if (population[i].fitness < lowestSoFar) { // worse chromosome
-            lowestSoFar = population[i].fitness;
+        if (fitness[i] < lowestSoFar) { // worse chromosome
+            lowestSoFar = fitness[i];
             worstFitness = lowestSoFar;
         }
-        totalFitness += population[i].fitness;
+        totalFitness += fitness[i];
     }
     averageFitness = totalFitness / populationSize;
 }
 
-void Genetic::reset() {
+template <typename Scalar>
+void Genetic<Scalar>::reset() {
     totalFitness = 0;
     bestFitness = 0;
     worstFitness = 99999999;
@@ -105,35 +410,150 @@ void Genetic::reset() {
 }
 
 
-std::vector<Chromosome> Genetic::runEpoch(std::vector<Chromosome> &previousPopulation) {
-    population = previousPopulation;
+template <typename Scalar>
+void Genetic<Scalar>::runEpoch() {
     reset();
-    sort(population.begin(), population.end()); // order the chromosomes acording to their fitness
     calculateFitnessMetrics();
+    prepareSelection();
+    if (cutoffPercentile >= 0) { // the generation just scored is the previous one for the next evaluation
+        cutoffScratch = fitness;
+        int rank = std::min(populationSize - 1, (int)(cutoffPercentile / 100 * populationSize));
+        std::nth_element(cutoffScratch.begin(), cutoffScratch.begin() + rank, cutoffScratch.end());
+        percentileCutoff = cutoffScratch[rank];
+    }
     
-    std::vector<Chromosome> newPopulation;
+    int bred = 0;
 
     // introduce elitism
     if (!(numberEliteCopies * numberElite % 2)) { // ensure we have an even number, or roulette wheel sampling breaks
-        takeBest(numberElite, numberEliteCopies, newPopulation);
+        bred = takeBest(numberElite, numberEliteCopies);
     }
     
-    // repeat until we have generated a new population
-    while (newPopulation.size() < populationSize) {
-        Chromosome progenitor1 = getChromosomeRoulette(); // take a chromosome
-        Chromosome progenitor2 = getChromosomeRoulette(); // take a chromosome
-        std::vector<double> progeny1, progeny2;
-        crossover(progenitor1.genes, progenitor2.genes, progeny1, progeny2);
-        mutate(progeny1);
-        mutate(progeny2);
-        newPopulation.push_back(Chromosome(progeny1, 0));
-        newPopulation.push_back(Chromosome(progeny2, 0));
+    // repeat until we have generated a new population, straight into the other buffer
+    while (bred < populationSize) {
+        int progenitor1 = selectChromosome(); // take a chromosome
+        int progenitor2 = selectChromosome(); // take a chromosome
+        int index1 = bred++, index2 = bred;
+        bool room = index2 < populationSize; // an odd population has room for only one
+        if (room) bred++;
+        Scalar *progeny1 = row(1 - current, index1), *progeny2 = room ? row(1 - current, index2) : spare.data();
+        bool crossed = crossover(progenitor1, progenitor2, progeny1, progeny2);
+        inherit(index1, progenitor1, mutate(progeny1) > 0 || crossed); // plain copies keep their parent's fitness
+        if (room) inherit(index2, progenitor2, mutate(progeny2) > 0 || crossed);
     }
-    population = newPopulation;
-    return population;
+    current = 1 - current;
+    fitness.swap(nextFitness);
+    stale.swap(nextStale);
+    generation++;
 }
 
 
+template <typename Scalar>
+void Genetic<Scalar>::save(std::ostream &out) const {
+    writeBinary(out, (int32_t)populationSize);
+    writeBinary(out, (int32_t)chromosomeLength);
+    writeBinary(out, (int32_t)generation);
+    writeBinary(out, random);
+    writeBinary(out, mutationRate);
+    writeBinary(out, crossoverRate);
+    writeBinary(out, (int32_t)selection);
+    writeBinary(out, (int32_t)selectionSize);
+    writeBinary(out, (int32_t)crossoverMode);
+    writeBinary(out, blendAlpha);
+    writeBinary(out, cutoffPercentile);
+    writeBinary(out, genes[current]);
+    writeBinary(out, fitness);
+    writeBinary(out, stale);
+    writeBinary(out, ranking); // nth_element picks among ties by position, so the order matters to the next generation
+}
+
+template <typename Scalar>
+bool Genetic<Scalar>::load(std::istream &in) {
+    int32_t size, length, savedGeneration, savedSelection, savedTournament, savedCrossover;
+    if (!readBinary(in, size) || !readBinary(in, length) || size != populationSize || length != chromosomeLength) return false;
+    if (!readBinary(in, savedGeneration) || !readBinary(in, random) || !readBinary(in, mutationRate) || !readBinary(in, crossoverRate)) return false;
+    if (!readBinary(in, savedSelection) || !readBinary(in, savedTournament) || !readBinary(in, savedCrossover) || !readBinary(in, blendAlpha) || !readBinary(in, cutoffPercentile)) return false;
+    if (savedSelection < 0 || savedSelection >= SELECTION_MODES || savedCrossover < 0 || savedCrossover >= CROSSOVER_MODES) return false;
+    if (!readBinary(in, genes[current], (size_t)populationSize * chromosomeLength) || !readBinary(in, fitness, populationSize)) return false;
+    if (!readBinary(in, stale, populationSize) || !readBinary(in, ranking, populationSize)) return false;
+    generation = savedGeneration;
+    selection = (Selection)savedSelection;
+    selectionSize = savedTournament;
+    crossoverMode = (Crossover)savedCrossover;
+    for (int index : ranking) {
+        if (index < 0 || index >= populationSize) return false;
+    }
+    return true;
+}
+
+
+template <typename Scalar>
+IslandModel<Scalar>::IslandModel(int count, int populationSize, double mutationRate, double crossoverRate, int chromosomeLength, uint64_t seed) :
+random(seed, count),
+migration(MigrationRing),
+migrants(0) {
+    count = std::max(1, std::min(count, populationSize));
+    islands.reserve(count);
+    for (int k = 0; k < count; k++) {
+        int size = populationSize / count + (k < populationSize % count); // the first islands take the remainder
+        islands.emplace_back(size, mutationRate, crossoverRate, chromosomeLength, seed, k);
+    }
+}
 
+template <typename Scalar>
+void IslandModel<Scalar>::setMigration(Migration mode, int count) {
+    migration = mode;
+    int smallest = islands.back().getPopulationSize();
+    migrants = std::max(0, std::min(count, smallest / 2));
+    int length = islands[0].getChromosomeLength();
+    travellers.resize((size_t)islands.size() * migrants * length);
+    travellerFitness.resize(islands.size() * migrants);
+    travellerExact.resize(islands.size() * migrants);
+}
+
+template <typename Scalar>
+void IslandModel<Scalar>::migrate() {
+    int count = islands.size(), length = islands[0].getChromosomeLength();
+    if (count < 2 || migrants == 0) return;
+    
+    // everyone leaves before anyone arrives, so no island sends on the migrants it just received
+    for (int k = 0; k < count; k++) {
+        islands[k].copyFittest(migrants, travellers.data() + (size_t)k * migrants * length, &travellerFitness[k * migrants], &travellerExact[k * migrants]);
+    }
+    for (int k = 0; k < count; k++) {
+        int destination = (k + 1) % count;
+        if (migration == MigrationRandom) {
+            destination = random.range(0, count - 2);
+            if (destination >= k) destination++; // any island but this one
+        }
+        islands[destination].replaceWeakest(migrants, travellers.data() + (size_t)k * migrants * length, &travellerFitness[k * migrants], &travellerExact[k * migrants]);
+    }
+}
+
+template <typename Scalar>
+void IslandModel<Scalar>::save(std::ostream &out) const {
+    writeBinary(out, (int32_t)islands.size());
+    writeBinary(out, (int32_t)migration);
+    writeBinary(out, (int32_t)migrants);
+    writeBinary(out, random);
+    for (const Genetic<Scalar> &island : islands) island.save(out);
+}
+
+template <typename Scalar>
+bool IslandModel<Scalar>::load(std::istream &in) {
+    int32_t count, savedMigration, savedMigrants;
+    if (!readBinary(in, count) || count != (int32_t)islands.size()) return false;
+    if (!readBinary(in, savedMigration) || !readBinary(in, savedMigrants) || !readBinary(in, random)) return false;
+    if (savedMigration < 0 || savedMigration >= MIGRATION_MODES) return false;
+    setMigration((Migration)savedMigration, savedMigrants);
+    for (Genetic<Scalar> &island : islands) {
+        if (!island.load(in)) return false;
+    }
+    return true;
+}
 
 
+template class Genetic<float>;
+template class Genetic<double>;
+template class IslandModel<float>;
+template class IslandModel<double>;
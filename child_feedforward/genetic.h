@@ -6,23 +6,87 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
 #include <math.h>
 
-struct Chromosome {
-	std::vector<double> genes;
-    double fitness;
-    Chromosome() : fitness(0) {}
-    Chromosome(std::vector<double> genes, double fitness) : genes(genes), fitness(fitness) {}
-    friend bool operator<(const Chromosome& lhs, const Chromosome& rhs) { return (lhs.fitness < rhs.fitness); } // used for sorting
+#include "utils.h"
+#include "random.h"
+
+#define GENETIC_SKIP_MAX_RATE 0.5 ///< highest mutation rate at which skipping (a log per mutated gene) beats a bulk mask (three draws per gene)
+#define GENETIC_MASK_BLOCK 1024 ///< genes mutated per bulk draw, so the draws stay in L1
+
+/// Selection is how Genetic picks the parents of each offspring, each costs O(populationSize) per generation to set up
+enum Selection {
+    SelectionRoulette, ///< fitness proportional, a binary search over the cumulative fitness, O(log n) per pick
+    SelectionAlias, ///< fitness proportional, Walker's alias method, O(1) per pick
+    SelectionUniversal, ///< stochastic universal sampling: a generation's parents come from one spin with evenly spaced pointers, shuffled
+    SelectionTournament, ///< the fittest of selectionSize chromosomes drawn at random, O(selectionSize) per pick and no setup
+    SelectionTruncation, ///< any of the selectionSize fittest chromosomes, evenly; only which chromosomes those are matters, not their fitness
+    SELECTION_MODES
+};
+
+const char *selectionName(Selection mode);
+bool selectionFromName(std::string name, Selection &mode); ///< fails for names other than "roulette", "alias", "universal", "tournament" and "truncation"
+
+/// Crossover is how Genetic mixes two parents into two offspring, each gets the genes the other does not
+enum Crossover {
+    CrossoverSinglePoint, ///< the genes after one random point are swapped
+    CrossoverTwoPoint, ///< the genes between two random points are swapped
+    CrossoverUniform, ///< every gene is swapped with probability 1/2
+    CrossoverArithmetic, ///< weighted averages of the parents, with one random weight per pair
+    CrossoverBlend, ///< BLX-alpha: every gene is drawn from the parents' interval widened by alpha of its length on each side
+    CrossoverNeuron, ///< like uniform, but genes of the same group (a neuron's weights and bias, see setGeneGroups()) go together
+    CROSSOVER_MODES
 };
 
-/// Genetic is the class that encapsulates the genetic algorithm itself
+const char *crossoverName(Crossover mode);
+bool crossoverFromName(std::string name, Crossover &mode); ///< fails for names other than "single", "two", "uniform", "arithmetic", "blend" and "neuron"
+
+/// Migration is where IslandModel sends each island's emigrants
+enum Migration {
+    MigrationRing, ///< island k sends to island k + 1, the last to the first
+    MigrationRandom, ///< every island sends to another drawn at random, so an island may receive from several or none
+    MIGRATION_MODES
+};
+
+const char *migrationName(Migration mode);
+bool migrationFromName(std::string name, Migration &mode); ///< fails for names other than "ring" and "random"
+
+/// Genetic is the class that encapsulates the genetic algorithm itself, Scalar is the gene type. The population is one
+/// aligned populationSize x chromosomeLength matrix, a chromosome per row, with a second matrix the next generation is bred
+/// into; the two are swapped every epoch, so nothing is allocated or copied wholesale after construction. Chromosomes are
+/// ranked and selected by index.
+template <typename Scalar>
 class Genetic {
     static const double maximumMutation;
-    static const int numberEliteCopies;
-    static const int numberElite;
+    static const int numberEliteCopies = 1;
+    static const int numberElite = 4;
     
-    std::vector<Chromosome> population;
+    Random random; ///< this population's own stream, so populations can evolve on different threads in any order
+    AlignedVector<Scalar> genes[2]; ///< the current generation and the one being bred, row-major
+    int current; ///< which of genes holds the current generation
+    std::vector<double> fitness; ///< one per chromosome of the current generation
+    std::vector<double> nextFitness; ///< the fitness offspring inherit while being bred, swapped with fitness every epoch
+    std::vector<char> stale; ///< set for chromosomes whose fitness is unknown, clear for unchanged copies of a scored parent
+    std::vector<char> nextStale;
+    double cutoffPercentile; ///< the percentile of each generation's fitness runEpoch() records for getPercentileCutoff(), negative for none
+    double percentileCutoff;
+    std::vector<double> cutoffScratch;
+    std::vector<int> ranking; ///< chromosome indices, the last numberElite hold the best in ascending order after calculateFitnessMetrics()
+    Selection selection;
+    int selectionSize; ///< SelectionTournament's chromosomes per tournament, SelectionTruncation's fittest chromosomes picked from
+    std::vector<double> cumulativeFitness; ///< SelectionRoulette's running sum of fitness
+    std::vector<double> aliasProbability; ///< SelectionAlias: slot i keeps i with this probability, else takes aliasIndex[i]
+    std::vector<int> aliasIndex;
+    std::vector<int> selected; ///< SelectionUniversal's parents for the generation, handed out in turn, SelectionTruncation's candidates in index order
+    int selectedNext;
+    std::vector<double> draws; ///< bulk random numbers for a block of genes, see mutate()
+    Crossover crossoverMode;
+    double blendAlpha; ///< how far CrossoverBlend reaches past the parents
+    std::vector<int> geneGroups; ///< CrossoverNeuron's group of each gene, empty for uniform
+    int numberOfGroups;
+    AlignedVector<Scalar> crossoverDraws; ///< bulk random numbers for a block of genes (or one per group), see crossover()
+    AlignedVector<Scalar> spare; ///< where the second offspring of the last pair goes when the population is odd
     int populationSize;
     int chromosomeLength;
     double totalFitness;
@@ -34,24 +98,84 @@ class Genetic {
     double crossoverRate;
     int generation;
     
-    void crossover(const std::vector<double> &progenitor1, const std::vector<double> &progenitor2, std::vector<double> &progeny1, std::vector<double> &progeny2);
-    void mutate(std::vector<double> &chromosome);
+    Scalar *row(int generationBuffer, int index) { return genes[generationBuffer].data() + (size_t)index * chromosomeLength; }
     
-    Chromosome getChromosomeRoulette();
+    bool crossover(int progenitor1, int progenitor2, Scalar *progeny1, Scalar *progeny2); ///< breeds two rows of the current generation into two rows of the next, returns false when they are plain copies
+    int mutate(Scalar *chromosome); ///< returns the number of genes changed, sparse rates jump between mutated genes with geometric skips, dense ones test every gene against a bulk drawn mask
     
-    void takeBest(int num, const int numcopies, std::vector<Chromosome> &pop); // used to introduce elitism
+    void prepareSelection(); ///< builds the current Selection's tables from this generation's fitness
+    int selectChromosome(); ///< returns the index of a parent picked the current Selection's way
     
-    void calculateFitnessMetrics();
+    int takeBest(int num, const int numcopies); // used to introduce elitism, returns the number of rows written to the next generation
+    void inherit(int progeny, int progenitor, bool changed); ///< the progeny's fitness is its progenitor's unless it changed
     
     void reset();
     
 public:
-    Genetic(int populationSize, double mutationRate, double crossoverRate, int chromosomeLength);
+    Genetic(int populationSize, double mutationRate, double crossoverRate, int chromosomeLength, uint64_t seed, uint64_t stream = 0); ///< starts from random genes with zero fitness, drawn like everything else from stream of seed
+    
+    void setSelection(Selection mode, int selectionSize = 2);
+    void setCrossover(Crossover mode, double blendAlpha = 0.5);
+    void setGeneGroups(const std::vector<int> &groups); ///< one group number per gene, numbered from 0, for CrossoverNeuron
+    
+    void runEpoch(); ///< ranks the current generation by fitness and replaces it with its offspring, whose fitness is zero
+    void calculateFitnessMetrics(); ///< ranks the current generation and updates the best, average and worst fitness
     
-    std::vector<Chromosome> runEpoch(std::vector<Chromosome> &previousPopulation);
+    int getPopulationSize() const { return populationSize; }
+    int getChromosomeLength() const { return chromosomeLength; }
+    Span<Scalar> getGenes(int index) { return Span<Scalar>(row(current, index), chromosomeLength); }
+    Span<const Scalar> getGenes(int index) const { return Span<const Scalar>(genes[current].data() + (size_t)index * chromosomeLength, chromosomeLength); }
+    double getFitness(int index) const { return fitness[index]; }
+    void setFitness(int index, double value, bool exact = true) { fitness[index] = value; stale[index] = !exact; } ///< chromosomes may be scored concurrently, each by one thread; inexact scores (estimates) are not carried over to copies
+    bool needsEvaluation(int index) const { return stale[index]; } ///< false for elites and offspring identical to a scored parent, which keep its fitness
+    void invalidateFitness(); ///< marks every chromosome for evaluation, for when what fitness measures changes
+    
+    void copyFittest(int count, Scalar *chromosomes, double *fitnesses, char *exact); ///< copies out the count fittest chromosomes of the current generation, row after row, with their fitness and whether it is exact
+    void replaceWeakest(int count, const Scalar *chromosomes, const double *fitnesses, const char *exact); ///< overwrites the count least fit chromosomes of the current generation, taking copyFittest()'s output
+    
+    /// the lowest fitness that can still make the elite of the current generation, and under SelectionTruncation the
+    /// chromosomes parents are picked from: the numberElite-th (or selectionSize-th, if more) best among the chromosomes that
+    /// already have a fitness (the elite carried over always do), -infinity when there are too few. A chromosome sure to
+    /// score below it can stop being evaluated without changing which chromosomes are elite, nor, under SelectionTruncation,
+    /// which are parents, so a single population evolves exactly as if every chromosome had been evaluated in full.
+    double getEliteCutoff() const;
+    void setCutoffPercentile(double percentile); ///< 0 to 100, negative to stop recording it
+    double getPercentileCutoff() const { return percentileCutoff; } ///< the fitness at the set percentile of the previous generation
     
-    std::vector<Chromosome> getChromosomes() const { return population; }
 	int getBestChromosome() const { return bestChromosome; }
     double getAverageFitness() const { return totalFitness / populationSize; }
     double getBestFitness() const { return bestFitness; }
+    
+    /// writes everything the next generations depend on in binary: the current generation's genes, fitness and ranking,
+    /// the random stream, and the rates, Selection and Crossover
+    void save(std::ostream &out) const;
+    bool load(std::istream &in); ///< restores what save() wrote, fails (leaving the population in an unspecified state) unless the sizes match this one's
+};
+
+/// IslandModel splits a population into islands, Genetic populations of their own that evolve independently (each can be
+/// bred and scored on its own thread, and each draws from its own stream) apart from migrate(), which copies every island's
+/// fittest chromosomes over another's least fit. Islands evolving apart keep more diversity than one population.
+template <typename Scalar>
+class IslandModel {
+    std::vector<Genetic<Scalar>> islands;
+    Random random; ///< picks the destinations of MigrationRandom
+    Migration migration;
+    int migrants; ///< chromosomes each island sends per migrate()
+    AlignedVector<Scalar> travellers; ///< every island's emigrants in transit, island after island
+    std::vector<double> travellerFitness;
+    std::vector<char> travellerExact;
+    
+public:
+    /// splits populationSize chromosomes as evenly as possible into count islands, island k draws from stream k of seed
+    IslandModel(int count, int populationSize, double mutationRate, double crossoverRate, int chromosomeLength, uint64_t seed);
+    
+    int getNumberOfIslands() const { return islands.size(); }
+    Genetic<Scalar> &getIsland(int index) { return islands[index]; }
+    const Genetic<Scalar> &getIsland(int index) const { return islands[index]; }
+    
+    void setMigration(Migration mode, int migrants); ///< migrants is clamped to half the smallest island
+    void migrate(); ///< sends every island's fittest migrants to their destination, replacing its least fit, with their fitness
+    
+    void save(std::ostream &out) const; ///< writes the migration settings and stream, then every island, see Genetic::save()
+    bool load(std::istream &in); ///< restores what save() wrote, fails unless the island count and sizes match this one's
 };
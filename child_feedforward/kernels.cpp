@@ -0,0 +1,224 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "kernels.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+extern const Kernels<float> sse2FloatKernels[ACTIVATION_MODES]; // kernels_sse2.cpp
+extern const Kernels<double> sse2DoubleKernels[ACTIVATION_MODES];
+extern const Kernels<float> avx2FloatKernels[ACTIVATION_MODES]; // kernels_avx2.cpp
+extern const Kernels<double> avx2DoubleKernels[ACTIVATION_MODES];
+extern const Kernels<float> avx512FloatKernels[ACTIVATION_MODES]; // kernels_avx512.cpp
+extern const Kernels<double> avx512DoubleKernels[ACTIVATION_MODES];
+#endif
+
+
+/////////////////////////
+// Sigmoid table
+
+/// fills table with SIGMOID_TABLE_SIZE + 2 samples, the last one pads the interpolation at the top of the range
+template <typename T>
+static bool fillSigmoidTable(T *table) {
+    for (int i = 0; i < SIGMOID_TABLE_SIZE + 2; i++) {
+        double x = (i - SIGMOID_TABLE_SIZE / 2) * (2.0 * SIGMOID_TABLE_RANGE / SIGMOID_TABLE_SIZE);
+        table[i] = 1 / (1 + exp(-x));
+    }
+    return true;
+}
+
+template <> const float *sigmoidTable<float>() {
+    alignas(CACHE_LINE_SIZE) static float table[SIGMOID_TABLE_SIZE + 2];
+    static bool filled = fillSigmoidTable(table);
+    (void)filled;
+    return table;
+}
+
+template <> const double *sigmoidTable<double>() {
+    alignas(CACHE_LINE_SIZE) static double table[SIGMOID_TABLE_SIZE + 2];
+    static bool filled = fillSigmoidTable(table);
+    (void)filled;
+    return table;
+}
+
+
+/////////////////////////
+// Scalar fallback
+
+template <typename T>
+static T scalarDot(const T *a, const T *b, int n) {
+    T sum = 0;
+    for (int k = 0; k < n; k++) sum += a[k] * b[k];
+    return sum;
+}
+
+template <typename T>
+static void scalarSigmoid(T *values, int n, T response) {
+    for (int k = 0; k < n; k++) values[k] = 1 / (1 + exp(-values[k] / response));
+}
+
+template <typename T>
+static void scalarSigmoidTable(T *values, int n, T response) {
+    const T *table = sigmoidTable<T>();
+    const T perUnit = (T)SIGMOID_TABLE_SIZE / (2 * SIGMOID_TABLE_RANGE) / response;
+    for (int k = 0; k < n; k++) {
+        T t = std::max<T>(0, std::min<T>(SIGMOID_TABLE_SIZE, values[k] * perUnit + SIGMOID_TABLE_SIZE / 2));
+        int i = (int)t;
+        values[k] = table[i] + (t - i) * (table[i + 1] - table[i]);
+    }
+}
+
+/// the scalar form of SimdExp::fastExp: e^x = 2^k e^r, e^r through r^5, 2^k built in the exponent bits
+static inline double fastExp(double x) {
+    x = std::max(-708.0, std::min(708.0, x));
+    const double magic = 6755399441055744.0; // 1.5 * 2^52, adding it rounds to an integer
+    double k = (x * 1.4426950408889634 + magic) - magic;
+    double r = x - k * 6.93145751953125e-1 - k * 1.42860682030941723212e-6;
+    double p = 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1;
+    p = p * r + 1;
+    uint64_t bits = (uint64_t)((int64_t)k + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+template <typename T>
+static void scalarSigmoidPoly(T *values, int n, T response) {
+    double scale = -1.0 / response;
+    for (int k = 0; k < n; k++) values[k] = 1 / (1 + (T)fastExp(values[k] * scale));
+}
+
+template <typename T, void (*Sigmoid)(T *, int, T)>
+static void scalarLayerForward(const T *weights, const T *biases, const T *inputs, T *outputs, int rows, int cols, T biasCoefficient, T response) {
+    for (int j = 0; j < rows; j++) {
+        outputs[j] = scalarDot(weights + (size_t)j * cols, inputs, cols) + biases[j] * biasCoefficient;
+    }
+    Sigmoid(outputs, rows, response);
+}
+
+template <typename T, void (*Sigmoid)(T *, int, T)>
+static void scalarLayerForwardBatch(const T *weights, const T *biases, const T *inputs, T *outputs, int samples, int rows, int cols, T biasCoefficient, T response) {
+    for (int s = 0; s < samples; s++) {
+        scalarLayerForward<T, Sigmoid>(weights, biases, inputs + (size_t)s * cols, outputs + (size_t)s * rows, rows, cols, biasCoefficient, response);
+    }
+}
+
+static void scalarLayerInt8(const int8_t *weights, const int8_t *inputs, int32_t *outputs, int rows, int cols) {
+    for (int j = 0; j < rows; j++) {
+        const int8_t *row = weights + (size_t)j * cols;
+        int32_t sum = 0;
+        for (int k = 0; k < cols; k++) sum += row[k] * inputs[k];
+        outputs[j] = sum;
+    }
+}
+
+template <typename T, void (*Sigmoid)(T *, int, T)>
+static void scalarLayerSparse(const T *values, const int32_t *columns, const int32_t *rowStarts, const T *biases, const T *inputs, T *outputs, int rows, T biasCoefficient, T response) {
+    for (int j = 0; j < rows; j++) {
+        T sum = 0;
+        for (int p = rowStarts[j]; p < rowStarts[j + 1]; p++) sum += values[p] * inputs[columns[p]];
+        outputs[j] = sum + biases[j] * biasCoefficient;
+    }
+    Sigmoid(outputs, rows, response);
+}
+
+#define SCALAR_KERNELS(T, sigmoid) { "scalar", scalarDot<T>, sigmoid<T>, scalarLayerForward<T, sigmoid<T> >, scalarLayerForwardBatch<T, sigmoid<T> >, scalarLayerInt8, scalarLayerSparse<T, sigmoid<T> >, fillUniform<void> }
+static const Kernels<float> scalarFloatKernels[ACTIVATION_MODES] = { SCALAR_KERNELS(float, scalarSigmoid), SCALAR_KERNELS(float, scalarSigmoidTable), SCALAR_KERNELS(float, scalarSigmoidPoly) };
+static const Kernels<double> scalarDoubleKernels[ACTIVATION_MODES] = { SCALAR_KERNELS(double, scalarSigmoid), SCALAR_KERNELS(double, scalarSigmoidTable), SCALAR_KERNELS(double, scalarSigmoidPoly) };
+
+
+/////////////////////////
+// Dispatch
+
+/// the float and double tables of one instruction set, one per Activation
+struct KernelSet {
+    const Kernels<float> *floats;
+    const Kernels<double> *doubles;
+};
+
+/// returns every kernel set this CPU can run, narrowest first
+static std::vector<KernelSet> supportedKernels() {
+    std::vector<KernelSet> supported;
+    supported.push_back({ scalarFloatKernels, scalarDoubleKernels });
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) supported.push_back({ sse2FloatKernels, sse2DoubleKernels });
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) supported.push_back({ avx2FloatKernels, avx2DoubleKernels });
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) supported.push_back({ avx512FloatKernels, avx512DoubleKernels });
+#endif
+    return supported;
+}
+
+static KernelSet &activeKernels() {
+    static KernelSet active = supportedKernels().back(); // widest available
+    return active;
+}
+
+static Activation &activeActivation() {
+    static Activation active = ActivationExact;
+    return active;
+}
+
+template <> const Kernels<float> &kernels<float>() {
+    return activeKernels().floats[activeActivation()];
+}
+
+template <> const Kernels<double> &kernels<double>() {
+    return activeKernels().doubles[activeActivation()];
+}
+
+bool selectKernels(std::string name) {
+    for (const KernelSet &k : supportedKernels()) {
+        if (name == k.doubles->name) {
+            activeKernels() = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> availableKernels() {
+    std::vector<std::string> names;
+    for (const KernelSet &k : supportedKernels()) names.push_back(k.doubles->name);
+    return names;
+}
+
+
+/////////////////////////
+// Activation
+
+static const char *activationNames[ACTIVATION_MODES] = { "exact", "table", "poly" };
+static const double activationErrors[ACTIVATION_MODES] = { 1e-7, 1e-6, 1e-6 }; // measured over [-40, 40] on every kernel set: exact 2.3e-16 (double) and 8.9e-8 (float), table 9.1e-7, poly 8.1e-7
+
+bool selectActivation(std::string name) {
+    for (int mode = 0; mode < ACTIVATION_MODES; mode++) {
+        if (name == activationNames[mode]) {
+            activeActivation() = (Activation)mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+Activation activation() {
+    return activeActivation();
+}
+
+const char *activationName(Activation mode) {
+    return activationNames[mode];
+}
+
+double activationMaxError(Activation mode) {
+    return activationErrors[mode];
+}
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "random.h"
+
+/// Activation picks how the sigmoid is evaluated, trading accuracy for speed. The bounds are the largest absolute error
+/// against 1 / (1 + e^-x) over all x.
+enum Activation {
+    ActivationExact, ///< exp from libm (scalar) or a degree 13 (double) / 7 (float) polynomial, within a few ulps (error below 1e-7)
+    ActivationTable, ///< linear interpolation in a SIGMOID_TABLE_SIZE entry table over +-SIGMOID_TABLE_RANGE, error below 1e-6
+    ActivationPoly, ///< exp from a degree 5 polynomial after the same range reduction as exact, error below 1e-6
+    ACTIVATION_MODES
+};
+
+#define SIGMOID_TABLE_SIZE 4096 ///< intervals in the sigmoid table
+#define SIGMOID_TABLE_RANGE 16 ///< the sigmoid table covers [-16, 16], outside it the sigmoid is within 1.2e-7 of 0 or 1
+
+/// Kernels is a table of the numeric inner loops behind NeuralNet::propagate, for one scalar type and one Activation. One
+/// set of tables exists per instruction set (scalar, SSE2, AVX2, AVX-512); the widest one the CPU supports is picked the
+/// first time kernels() is called, so the same binary runs everywhere.
+template <typename T>
+struct Kernels {
+    const char *name; ///< instruction set name, as accepted by selectKernels()
+
+    /// returns the dot product of a and b, both n long
+    T (*dot)(const T *a, const T *b, int n);
+
+    /// replaces each of the n values with 1 / (1 + e^(-value / response)), evaluated the table's Activation way
+    void (*sigmoid)(T *values, int n, T response);
+
+    /// evaluates a whole layer: outputs[j] = sigmoid(weights[j] . inputs + biases[j] * biasCoefficient) for each of the rows
+    /// neurons, where weights is a row-major rows x cols matrix
+    void (*layerForward)(const T *weights, const T *biases, const T *inputs, T *outputs, int rows, int cols, T biasCoefficient, T response);
+
+    /// layerForward for many samples at once: inputs is a row-major samples x cols matrix and outputs a samples x rows
+    /// matrix. The product is tiled so a block of weight rows stays cache resident while every sample streams past it.
+    void (*layerForwardBatch)(const T *weights, const T *biases, const T *inputs, T *outputs, int samples, int rows, int cols, T biasCoefficient, T response);
+
+    /// the integer product of a quantized layer: outputs[j] = weights[j] . inputs, int8 operands summed in int32
+    void (*layerInt8)(const int8_t *weights, const int8_t *inputs, int32_t *outputs, int rows, int cols);
+
+    /// layerForward for a matrix in compressed sparse row form: neuron j sums values[p] * inputs[columns[p]] for p in
+    /// [rowStarts[j], rowStarts[j + 1]), so zero weights cost nothing
+    void (*layerSparse)(const T *values, const int32_t *columns, const int32_t *rowStarts, const T *biases, const T *inputs, T *outputs, int rows, T biasCoefficient, T response);
+
+    /// fills values with n uniform random numbers in [0, 1) from a Random's xoshiro256+ lanes, see Random::fill()
+    void (*uniform)(uint64_t (&lanes)[4][RANDOM_LANES], T *values, size_t n);
+};
+
+#define SPARSE_MAX_DENSITY 0.3 ///< a pruned layer is evaluated in sparse form only when at most this fraction of its weights are nonzero
+#define KERNEL_L1_BYTES (24 * 1024) ///< working set targeted for the samples tile of the batched kernels
+#define KERNEL_L2_BYTES (192 * 1024) ///< working set targeted for the weights tile of the batched kernels
+
+template <typename T> const Kernels<T> &kernels(); ///< returns the kernels in use for scalar type T
+template <> const Kernels<float> &kernels<float>();
+template <> const Kernels<double> &kernels<double>();
+bool selectKernels(std::string name); ///< switches both scalar types to the named kernels, fails if the CPU does not support them
+std::vector<std::string> availableKernels(); ///< names of every kernel set this CPU can run, narrowest first
+
+bool selectActivation(std::string name); ///< switches every kernel set to the named Activation ("exact", "table" or "poly")
+Activation activation(); ///< the Activation in use
+const char *activationName(Activation mode);
+double activationMaxError(Activation mode); ///< the documented bound on the absolute error of mode's sigmoid
+
+template <typename T> const T *sigmoidTable(); ///< SIGMOID_TABLE_SIZE + 2 samples of the sigmoid, evenly spaced from -SIGMOID_TABLE_RANGE
+template <> const float *sigmoidTable<float>();
+template <> const double *sigmoidTable<double>();
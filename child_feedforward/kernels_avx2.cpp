@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+// compiled with -mavx2 -mfma
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#include "kernels_simd.h"
+
+struct Avx2Double {
+    typedef double scalar;
+    typedef __m256d reg;
+    static const int width = 4;
+    static inline reg zero() { return _mm256_setzero_pd(); }
+    static inline reg set1(double x) { return _mm256_set1_pd(x); }
+    static inline reg loadu(const double *p) { return _mm256_loadu_pd(p); }
+    static inline void storeu(double *p, reg x) { _mm256_storeu_pd(p, x); }
+    static inline reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static inline reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+    static inline reg min(reg a, reg b) { return _mm256_min_pd(a, b); }
+    static inline reg max(reg a, reg b) { return _mm256_max_pd(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_pd(a, b, c); }
+    static inline double hsum(reg a) {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+    static inline reg pow2n(reg n) { return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(4503599627370496.0 + 1023))), 52)); }
+    static inline reg gather(const double *table, reg i) { return _mm256_mask_i32gather_pd(zero(), table, _mm256_cvtpd_epi32(i), _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8); } // masked form, the unmasked one trips -Wmaybe-uninitialized in gcc
+    static inline reg gatherIndexed(const double *base, const int32_t *indices) { return _mm256_mask_i32gather_pd(zero(), base, _mm_loadu_si128((const __m128i *)indices), _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8); }
+};
+
+struct Avx2Float {
+    typedef float scalar;
+    typedef __m256 reg;
+    static const int width = 8;
+    static inline reg zero() { return _mm256_setzero_ps(); }
+    static inline reg set1(float x) { return _mm256_set1_ps(x); }
+    static inline reg loadu(const float *p) { return _mm256_loadu_ps(p); }
+    static inline void storeu(float *p, reg x) { _mm256_storeu_ps(p, x); }
+    static inline reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    static inline reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+    static inline reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+    static inline reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_ps(a, b, c); }
+    static inline float hsum(reg a) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+    static inline reg pow2n(reg n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_castps_si256(_mm256_add_ps(n, _mm256_set1_ps(8388608.0f + 127))), 23)); }
+    static inline reg gather(const float *table, reg i) { return _mm256_mask_i32gather_ps(zero(), table, _mm256_cvtps_epi32(i), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4); }
+    static inline reg gatherIndexed(const float *base, const int32_t *indices) { return _mm256_mask_i32gather_ps(zero(), base, _mm256_loadu_si256((const __m256i *)indices), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4); }
+};
+
+/// int8 rows are sign extended to int16 and multiplied pairwise into int32 lanes (vpmaddwd)
+static void layerInt8(const int8_t *weights, const int8_t *inputs, int32_t *outputs, int rows, int cols) {
+    for (int j = 0; j < rows; j++) {
+        const int8_t *row = weights + (size_t)j * cols;
+        __m256i acc = _mm256_setzero_si256();
+        int k = 0;
+        for (; k + 16 <= cols; k += 16) {
+            __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(row + k)));
+            __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(inputs + k)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(w, x));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t sum = _mm_cvtsi128_si32(s);
+        for (; k < cols; k++) sum += row[k] * inputs[k];
+        outputs[j] = sum;
+    }
+}
+
+extern const Kernels<double> avx2DoubleKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("avx2", Avx2Double, layerInt8);
+extern const Kernels<float> avx2FloatKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("avx2", Avx2Float, layerInt8);
+
+#endif
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+// compiled with -mavx512f -mavx512bw
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#include "kernels_simd.h"
+
+struct Avx512Double {
+    typedef double scalar;
+    typedef __m512d reg;
+    static const int width = 8;
+    static inline reg zero() { return _mm512_setzero_pd(); }
+    static inline reg set1(double x) { return _mm512_set1_pd(x); }
+    static inline reg loadu(const double *p) { return _mm512_loadu_pd(p); }
+    static inline void storeu(double *p, reg x) { _mm512_storeu_pd(p, x); }
+    static inline reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    static inline reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+    static inline reg min(reg a, reg b) { return _mm512_min_pd(a, b); }
+    static inline reg max(reg a, reg b) { return _mm512_max_pd(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_pd(a, b, c); }
+    static inline double hsum(reg a) { return _mm512_reduce_add_pd(a); }
+    static inline reg pow2n(reg n) { return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(4503599627370496.0 + 1023))), 52)); }
+    static inline reg gather(const double *table, reg i) { return _mm512_i32gather_pd(_mm512_cvtpd_epi32(i), table, 8); }
+    static inline reg gatherIndexed(const double *base, const int32_t *indices) { return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)indices), base, 8); }
+};
+
+struct Avx512Float {
+    typedef float scalar;
+    typedef __m512 reg;
+    static const int width = 16;
+    static inline reg zero() { return _mm512_setzero_ps(); }
+    static inline reg set1(float x) { return _mm512_set1_ps(x); }
+    static inline reg loadu(const float *p) { return _mm512_loadu_ps(p); }
+    static inline void storeu(float *p, reg x) { _mm512_storeu_ps(p, x); }
+    static inline reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    static inline reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+    static inline reg min(reg a, reg b) { return _mm512_min_ps(a, b); }
+    static inline reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_ps(a, b, c); }
+    static inline float hsum(reg a) { return _mm512_reduce_add_ps(a); }
+    static inline reg pow2n(reg n) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_castps_si512(_mm512_add_ps(n, _mm512_set1_ps(8388608.0f + 127))), 23)); }
+    static inline reg gather(const float *table, reg i) { return _mm512_i32gather_ps(_mm512_cvtps_epi32(i), table, 4); }
+    static inline reg gatherIndexed(const float *base, const int32_t *indices) { return _mm512_i32gather_ps(_mm512_loadu_si512(indices), base, 4); }
+};
+
+/// int8 rows are sign extended to int16 and multiplied pairwise into int32 lanes (vpmaddwd, needs AVX-512BW)
+static void layerInt8(const int8_t *weights, const int8_t *inputs, int32_t *outputs, int rows, int cols) {
+    for (int j = 0; j < rows; j++) {
+        const int8_t *row = weights + (size_t)j * cols;
+        __m512i acc = _mm512_setzero_si512();
+        int k = 0;
+        for (; k + 32 <= cols; k += 32) {
+            __m512i w = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(row + k)));
+            __m512i x = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(inputs + k)));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(w, x));
+        }
+        int32_t sum = _mm512_reduce_add_epi32(acc);
+        for (; k < cols; k++) sum += row[k] * inputs[k];
+        outputs[j] = sum;
+    }
+}
+
+extern const Kernels<double> avx512DoubleKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("avx512", Avx512Double, layerInt8);
+extern const Kernels<float> avx512FloatKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("avx512", Avx512Float, layerInt8);
+
+#endif
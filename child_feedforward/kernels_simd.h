@@ -0,0 +1,274 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Shared bodies for the vectorized kernels. Only include this from a kernels_<isa>.cpp file, which is compiled with the
+// matching instruction set flags and supplies a traits type V:
+//   scalar         float or double
+//   reg            the vector register type
+//   width          number of scalars in a register
+//   zero, set1, loadu, storeu, add, sub, mul, div, min, max, fmadd (a*b+c), fnmadd (c-a*b)
+//   hsum           horizontal sum of a register
+//   pow2n          2^n for a register of integral values
+//   gather         loads table[i] for a register of integral values i
+//   gatherIndexed  loads base[indices[0]] .. base[indices[width - 1]]
+
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include "kernels.h"
+
+/// e^x for a register of doubles or floats: x = k ln2 + r with |r| <= ln2/2, e^r from its Taylor series, then scaled by 2^k.
+/// exp() is accurate to a few ulps, fastExp() stops at r^5 for a relative error below 2.5e-6.
+template <class V, typename T = typename V::scalar>
+struct SimdExp;
+
+template <class V>
+struct SimdExp<V, double> {
+    typedef typename V::reg reg;
+    static inline reg reduce(reg x, reg &k) {
+        x = V::max(V::min(x, V::set1(708.0)), V::set1(-708.0)); // keep 2^k a normal double
+        const reg magic = V::set1(6755399441055744.0); // 1.5 * 2^52, adding it rounds to an integer
+        k = V::sub(V::add(V::mul(x, V::set1(1.4426950408889634)), magic), magic); // round(x / ln2)
+        reg r = V::fnmadd(k, V::set1(6.93145751953125e-1), x); // ln2 split in two for an exact reduction
+        return V::fnmadd(k, V::set1(1.42860682030941723212e-6), r);
+    }
+    static inline reg exp(reg x) {
+        reg k, r = reduce(x, k);
+        reg p = V::set1(1.0 / 6227020800.0); // through r^13
+        p = V::fmadd(p, r, V::set1(1.0 / 479001600.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 39916800.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 3628800.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 362880.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 40320.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 5040.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 720.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 120.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 24.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 6.0));
+        p = V::fmadd(p, r, V::set1(0.5));
+        p = V::fmadd(p, r, V::set1(1.0));
+        p = V::fmadd(p, r, V::set1(1.0));
+        return V::mul(p, V::pow2n(k));
+    }
+    static inline reg fastExp(reg x) {
+        reg k, r = reduce(x, k);
+        reg p = V::set1(1.0 / 120.0); // through r^5
+        p = V::fmadd(p, r, V::set1(1.0 / 24.0));
+        p = V::fmadd(p, r, V::set1(1.0 / 6.0));
+        p = V::fmadd(p, r, V::set1(0.5));
+        p = V::fmadd(p, r, V::set1(1.0));
+        p = V::fmadd(p, r, V::set1(1.0));
+        return V::mul(p, V::pow2n(k));
+    }
+};
+
+template <class V>
+struct SimdExp<V, float> {
+    typedef typename V::reg reg;
+    static inline reg reduce(reg x, reg &k) {
+        x = V::max(V::min(x, V::set1(87.0f)), V::set1(-87.0f)); // keep 2^k a normal float
+        const reg magic = V::set1(12582912.0f); // 1.5 * 2^23, adding it rounds to an integer
+        k = V::sub(V::add(V::mul(x, V::set1(1.44269504f)), magic), magic); // round(x / ln2)
+        reg r = V::fnmadd(k, V::set1(0.693359375f), x); // ln2 split in two for an exact reduction
+        return V::fnmadd(k, V::set1(-2.12194440e-4f), r);
+    }
+    static inline reg exp(reg x) {
+        reg k, r = reduce(x, k);
+        reg p = V::set1(1.0f / 5040.0f); // through r^7
+        p = V::fmadd(p, r, V::set1(1.0f / 720.0f));
+        p = V::fmadd(p, r, V::set1(1.0f / 120.0f));
+        p = V::fmadd(p, r, V::set1(1.0f / 24.0f));
+        p = V::fmadd(p, r, V::set1(1.0f / 6.0f));
+        p = V::fmadd(p, r, V::set1(0.5f));
+        p = V::fmadd(p, r, V::set1(1.0f));
+        p = V::fmadd(p, r, V::set1(1.0f));
+        return V::mul(p, V::pow2n(k));
+    }
+    static inline reg fastExp(reg x) {
+        reg k, r = reduce(x, k);
+        reg p = V::set1(1.0f / 120.0f); // through r^5
+        p = V::fmadd(p, r, V::set1(1.0f / 24.0f));
+        p = V::fmadd(p, r, V::set1(1.0f / 6.0f));
+        p = V::fmadd(p, r, V::set1(0.5f));
+        p = V::fmadd(p, r, V::set1(1.0f));
+        p = V::fmadd(p, r, V::set1(1.0f));
+        return V::mul(p, V::pow2n(k));
+    }
+};
+
+/// the sigmoid of a register of values already divided by the response, one specialization per Activation
+template <class V, int Mode>
+struct SimdSigmoid;
+
+template <class V>
+struct SimdSigmoid<V, ActivationExact> {
+    typedef typename V::reg reg;
+    static inline reg apply(reg x) { return V::div(V::set1(1), V::add(V::set1(1), SimdExp<V>::exp(V::sub(V::zero(), x)))); }
+};
+
+template <class V>
+struct SimdSigmoid<V, ActivationPoly> {
+    typedef typename V::reg reg;
+    static inline reg apply(reg x) { return V::div(V::set1(1), V::add(V::set1(1), SimdExp<V>::fastExp(V::sub(V::zero(), x)))); }
+};
+
+template <class V>
+struct SimdSigmoid<V, ActivationTable> {
+    typedef typename V::scalar T;
+    typedef typename V::reg reg;
+    static inline reg apply(reg x) {
+        const T *table = sigmoidTable<T>();
+        const T perUnit = (T)SIGMOID_TABLE_SIZE / (2 * SIGMOID_TABLE_RANGE);
+        reg t = V::fmadd(x, V::set1(perUnit), V::set1((T)SIGMOID_TABLE_SIZE / 2)); // position in the table
+        t = V::max(V::min(t, V::set1((T)SIGMOID_TABLE_SIZE)), V::zero());
+        const reg magic = V::set1(sizeof(T) == 8 ? 6755399441055744.0 : 12582912.0); // rounds to an integer, see SimdExp
+        reg i = V::sub(V::add(V::sub(t, V::set1((T)0.5)), magic), magic); // floor(t), or one below at exact integers
+        reg low = V::gather(table, i), high = V::gather(table + 1, i);
+        return V::fmadd(V::sub(t, i), V::sub(high, low), low);
+    }
+};
+
+template <class V, int Mode = ActivationExact>
+struct SimdKernels {
+    typedef typename V::scalar T;
+    typedef typename V::reg reg;
+
+    static T dot(const T *a, const T *b, int n) {
+        reg acc0 = V::zero(), acc1 = V::zero(); // two chains to hide the fma latency
+        int k = 0;
+        for (; k + 2 * V::width <= n; k += 2 * V::width) {
+            acc0 = V::fmadd(V::loadu(a + k), V::loadu(b + k), acc0);
+            acc1 = V::fmadd(V::loadu(a + k + V::width), V::loadu(b + k + V::width), acc1);
+        }
+        for (; k + V::width <= n; k += V::width) acc0 = V::fmadd(V::loadu(a + k), V::loadu(b + k), acc0);
+        T sum = V::hsum(V::add(acc0, acc1));
+        for (; k < n; k++) sum += a[k] * b[k];
+        return sum;
+    }
+
+    static void sigmoid(T *values, int n, T response) {
+        const reg scale = V::set1(1 / response);
+        int k = 0;
+        for (; k + V::width <= n; k += V::width) V::storeu(values + k, SimdSigmoid<V, Mode>::apply(V::mul(V::loadu(values + k), scale)));
+        if (k < n) { // the tail goes through a padded register so every value gets the same approximation
+            T tail[V::width] = { 0 };
+            std::copy(values + k, values + n, tail);
+            V::storeu(tail, SimdSigmoid<V, Mode>::apply(V::mul(V::loadu(tail), scale)));
+            std::copy(tail, tail + (n - k), values + k);
+        }
+    }
+
+    static void layerForward(const T *weights, const T *biases, const T *inputs, T *outputs, int rows, int cols, T biasCoefficient, T response) {
+        int j = 0;
+        for (; j + 4 <= rows; j += 4) { // four neurons at a time share each load of the inputs
+            const T *w0 = weights + (size_t)j * cols;
+            const T *w1 = w0 + cols, *w2 = w1 + cols, *w3 = w2 + cols;
+            reg a0 = V::zero(), a1 = V::zero(), a2 = V::zero(), a3 = V::zero();
+            int k = 0;
+            for (; k + V::width <= cols; k += V::width) {
+                reg x = V::loadu(inputs + k);
+                a0 = V::fmadd(V::loadu(w0 + k), x, a0);
+                a1 = V::fmadd(V::loadu(w1 + k), x, a1);
+                a2 = V::fmadd(V::loadu(w2 + k), x, a2);
+                a3 = V::fmadd(V::loadu(w3 + k), x, a3);
+            }
+            T s0 = V::hsum(a0), s1 = V::hsum(a1), s2 = V::hsum(a2), s3 = V::hsum(a3);
+            for (; k < cols; k++) {
+                s0 += w0[k] * inputs[k];
+                s1 += w1[k] * inputs[k];
+                s2 += w2[k] * inputs[k];
+                s3 += w3[k] * inputs[k];
+            }
+            outputs[j] = s0 + biases[j] * biasCoefficient;
+            outputs[j + 1] = s1 + biases[j + 1] * biasCoefficient;
+            outputs[j + 2] = s2 + biases[j + 2] * biasCoefficient;
+            outputs[j + 3] = s3 + biases[j + 3] * biasCoefficient;
+        }
+        for (; j < rows; j++) outputs[j] = dot(weights + (size_t)j * cols, inputs, cols) + biases[j] * biasCoefficient;
+        sigmoid(outputs, rows, response);
+    }
+
+    /// 2 samples x 4 neurons register tile: eight accumulators fed by six loads per step
+    static inline void tile2x4(const T *w0, int cols, const T *x0, const T *x1, T *out0, T *out1) {
+        const T *w1 = w0 + cols, *w2 = w1 + cols, *w3 = w2 + cols;
+        reg a00 = V::zero(), a01 = V::zero(), a02 = V::zero(), a03 = V::zero();
+        reg a10 = V::zero(), a11 = V::zero(), a12 = V::zero(), a13 = V::zero();
+        int k = 0;
+        for (; k + V::width <= cols; k += V::width) {
+            reg x = V::loadu(x0 + k), y = V::loadu(x1 + k);
+            reg w = V::loadu(w0 + k);
+            a00 = V::fmadd(w, x, a00); a10 = V::fmadd(w, y, a10);
+            w = V::loadu(w1 + k);
+            a01 = V::fmadd(w, x, a01); a11 = V::fmadd(w, y, a11);
+            w = V::loadu(w2 + k);
+            a02 = V::fmadd(w, x, a02); a12 = V::fmadd(w, y, a12);
+            w = V::loadu(w3 + k);
+            a03 = V::fmadd(w, x, a03); a13 = V::fmadd(w, y, a13);
+        }
+        T s00 = V::hsum(a00), s01 = V::hsum(a01), s02 = V::hsum(a02), s03 = V::hsum(a03);
+        T s10 = V::hsum(a10), s11 = V::hsum(a11), s12 = V::hsum(a12), s13 = V::hsum(a13);
+        for (; k < cols; k++) {
+            s00 += w0[k] * x0[k]; s01 += w1[k] * x0[k]; s02 += w2[k] * x0[k]; s03 += w3[k] * x0[k];
+            s10 += w0[k] * x1[k]; s11 += w1[k] * x1[k]; s12 += w2[k] * x1[k]; s13 += w3[k] * x1[k];
+        }
+        out0[0] = s00; out0[1] = s01; out0[2] = s02; out0[3] = s03;
+        out1[0] = s10; out1[1] = s11; out1[2] = s12; out1[3] = s13;
+    }
+
+    static void layerForwardBatch(const T *weights, const T *biases, const T *inputs, T *outputs, int samples, int rows, int cols, T biasCoefficient, T response) {
+        size_t rowBytes = (size_t)(cols > 0 ? cols : 1) * sizeof(T);
+        int rowBlock = std::max<int>(4, (KERNEL_L2_BYTES / rowBytes) & ~3); // weight rows kept hot
+        int sampleBlock = std::max<int>(2, (KERNEL_L1_BYTES / rowBytes) & ~1); // samples kept hot against them
+
+        for (int j0 = 0; j0 < rows; j0 += rowBlock) {
+            int j1 = std::min(rows, j0 + rowBlock);
+            for (int s0 = 0; s0 < samples; s0 += sampleBlock) {
+                int s1 = std::min(samples, s0 + sampleBlock);
+                int s = s0;
+                for (; s + 2 <= s1; s += 2) {
+                    const T *x0 = inputs + (size_t)s * cols, *x1 = x0 + cols;
+                    T *out0 = outputs + (size_t)s * rows, *out1 = out0 + rows;
+                    int j = j0;
+                    for (; j + 4 <= j1; j += 4) tile2x4(weights + (size_t)j * cols, cols, x0, x1, out0 + j, out1 + j);
+                    for (; j < j1; j++) {
+                        out0[j] = dot(weights + (size_t)j * cols, x0, cols);
+                        out1[j] = dot(weights + (size_t)j * cols, x1, cols);
+                    }
+                }
+                for (; s < s1; s++) { // odd sample left over
+                    for (int j = j0; j < j1; j++) outputs[(size_t)s * rows + j] = dot(weights + (size_t)j * cols, inputs + (size_t)s * cols, cols);
+                }
+            }
+        }
+
+        for (int s = 0; s < samples; s++) { // bias, then one long sigmoid pass over the whole block
+            T *out = outputs + (size_t)s * rows;
+            for (int j = 0; j < rows; j++) out[j] += biases[j] * biasCoefficient;
+        }
+        sigmoid(outputs, samples * rows, response);
+    }
+
+    static void layerSparse(const T *values, const int32_t *columns, const int32_t *rowStarts, const T *biases, const T *inputs, T *outputs, int rows, T biasCoefficient, T response) {
+        for (int j = 0; j < rows; j++) { // the inputs each row reads are gathered a register at a time
+            int p = rowStarts[j], end = rowStarts[j + 1];
+            reg acc0 = V::zero(), acc1 = V::zero();
+            for (; p + 2 * V::width <= end; p += 2 * V::width) {
+                acc0 = V::fmadd(V::loadu(values + p), V::gatherIndexed(inputs, columns + p), acc0);
+                acc1 = V::fmadd(V::loadu(values + p + V::width), V::gatherIndexed(inputs, columns + p + V::width), acc1);
+            }
+            for (; p + V::width <= end; p += V::width) acc0 = V::fmadd(V::loadu(values + p), V::gatherIndexed(inputs, columns + p), acc0);
+            T sum = V::hsum(V::add(acc0, acc1));
+            for (; p < end; p++) sum += values[p] * inputs[columns[p]];
+            outputs[j] = sum + biases[j] * biasCoefficient;
+        }
+        sigmoid(outputs, rows, response);
+    }
+};
+
+/// the brace initializer of a Kernels table for traits V and one Activation, layerInt8 does not depend on either
+#define SIMD_KERNELS(name, V, mode, layerInt8) { name, SimdKernels<V, mode>::dot, SimdKernels<V, mode>::sigmoid, SimdKernels<V, mode>::layerForward, SimdKernels<V, mode>::layerForwardBatch, layerInt8, SimdKernels<V, mode>::layerSparse, fillUniform<V> }
+#define SIMD_KERNELS_ALL_ACTIVATIONS(name, V, layerInt8) { SIMD_KERNELS(name, V, ActivationExact, layerInt8), SIMD_KERNELS(name, V, ActivationTable, layerInt8), SIMD_KERNELS(name, V, ActivationPoly, layerInt8) }
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+// compiled with -msse2
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+
+#include "kernels_simd.h"
+
+struct Sse2Double {
+    typedef double scalar;
+    typedef __m128d reg;
+    static const int width = 2;
+    static inline reg zero() { return _mm_setzero_pd(); }
+    static inline reg set1(double x) { return _mm_set1_pd(x); }
+    static inline reg loadu(const double *p) { return _mm_loadu_pd(p); }
+    static inline void storeu(double *p, reg x) { _mm_storeu_pd(p, x); }
+    static inline reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+    static inline reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+    static inline reg min(reg a, reg b) { return _mm_min_pd(a, b); }
+    static inline reg max(reg a, reg b) { return _mm_max_pd(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); } // no fma before AVX2
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm_sub_pd(c, _mm_mul_pd(a, b)); }
+    static inline double hsum(reg a) { return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a))); }
+    static inline reg pow2n(reg n) { return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(_mm_add_pd(n, _mm_set1_pd(4503599627370496.0 + 1023))), 52)); }
+    static inline reg gather(const double *table, reg i) { // no gather instruction before AVX2
+        __m128i n = _mm_cvtpd_epi32(i);
+        return _mm_set_pd(table[_mm_cvtsi128_si32(_mm_srli_si128(n, 4))], table[_mm_cvtsi128_si32(n)]);
+    }
+    static inline reg gatherIndexed(const double *base, const int32_t *indices) { return _mm_set_pd(base[indices[1]], base[indices[0]]); }
+};
+
+struct Sse2Float {
+    typedef float scalar;
+    typedef __m128 reg;
+    static const int width = 4;
+    static inline reg zero() { return _mm_setzero_ps(); }
+    static inline reg set1(float x) { return _mm_set1_ps(x); }
+    static inline reg loadu(const float *p) { return _mm_loadu_ps(p); }
+    static inline void storeu(float *p, reg x) { _mm_storeu_ps(p, x); }
+    static inline reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+    static inline reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+    static inline reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+    static inline reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+    static inline reg fmadd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static inline reg fnmadd(reg a, reg b, reg c) { return _mm_sub_ps(c, _mm_mul_ps(a, b)); }
+    static inline float hsum(reg a) {
+        reg s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+    static inline reg pow2n(reg n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_castps_si128(_mm_add_ps(n, _mm_set1_ps(8388608.0f + 127))), 23)); }
+    static inline reg gather(const float *table, reg i) {
+        __m128i n = _mm_cvtps_epi32(i);
+        return _mm_set_ps(table[_mm_cvtsi128_si32(_mm_srli_si128(n, 12))], table[_mm_cvtsi128_si32(_mm_srli_si128(n, 8))], table[_mm_cvtsi128_si32(_mm_srli_si128(n, 4))], table[_mm_cvtsi128_si32(n)]);
+    }
+    static inline reg gatherIndexed(const float *base, const int32_t *indices) { return _mm_set_ps(base[indices[3]], base[indices[2]], base[indices[1]], base[indices[0]]); }
+};
+
+/// int8 rows are sign extended to int16 and multiplied pairwise into int32 lanes (pmaddwd)
+static void layerInt8(const int8_t *weights, const int8_t *inputs, int32_t *outputs, int rows, int cols) {
+    for (int j = 0; j < rows; j++) {
+        const int8_t *row = weights + (size_t)j * cols;
+        __m128i acc = _mm_setzero_si128();
+        int k = 0;
+        for (; k + 16 <= cols; k += 16) {
+            __m128i w = _mm_loadu_si128((const __m128i *)(row + k)), x = _mm_loadu_si128((const __m128i *)(inputs + k));
+            __m128i wlo = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8), whi = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+            __m128i xlo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), xhi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(wlo, xlo), _mm_madd_epi16(whi, xhi)));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t sum = _mm_cvtsi128_si32(acc);
+        for (; k < cols; k++) sum += row[k] * inputs[k];
+        outputs[j] = sum;
+    }
+}
+
+extern const Kernels<double> sse2DoubleKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("sse2", Sse2Double, layerInt8);
+extern const Kernels<float> sse2FloatKernels[ACTIVATION_MODES] = SIMD_KERNELS_ALL_ACTIVATIONS("sse2", Sse2Float, layerInt8);
+
+#endif
@@ -13,14 +13,19 @@ static void show_usage(std::string name) {
         << "Options:\n"
         << "\t-h,--help\t\t\tShow this help message\n"
         << "\t-c,--child\t\t\tRun as a child process, managed by coordinator. No REPL.\n"
-        << "\t-C,--commands COMMANDS_FILE\tSpecify a command file to run on startup"
+        << "\t-C,--commands COMMANDS_FILE\tSpecify a command file to run on startup\n"
+        << "\t-p,--precision float|double\tScalar type for weights and activations (default: double)\n"
+        << "\t-s,--seed SEED\t\t\tRandom seed, so runs can be repeated (default: the current time)\n"
+        << "\t-w,--workers COUNT\t\tTrain as a master scoring chromosomes in COUNT worker processes (default: 0, threads)"
         << std::endl;
 }
 
 
-void engage(std::string structureFile, std::string weightsFile, std::string commandsFile, bool child) {
+template <typename Scalar>
+void engage(std::string structureFile, std::string weightsFile, std::string commandsFile, bool child, int workers) {
     // initialize neuralnet
-    NeuralHost nn = NeuralHost(realpath(structureFile.c_str(), NULL), realpath(weightsFile.c_str(), NULL));
+    NeuralHost<Scalar> nn(realpath(structureFile.c_str(), NULL), realpath(weightsFile.c_str(), NULL));
+    if (workers > 0) nn.runCommand("workers " + std::to_string(workers));
     
     if (commandsFile != "") { // did the user supply a commands file
         char* commandspath = realpath(commandsFile.c_str(), NULL);
@@ -56,6 +61,9 @@ int main(int argc, char* argv[]) { // main almost exclusively does parameter pro
     bool capturedStructureAndWeights = false;
     std::string commandsFile = "";
     bool runningAsChild = false;
+    std::string precision = "double";
+    uint64_t seed = time(NULL);
+    int workers = 0;
     for (int i = 1; i < argc; ++i) { // iterate over argument vector
         std::string arg = argv[i];
         if ((arg == "-h") || (arg == "--help")) {
@@ -70,6 +78,31 @@ int main(int argc, char* argv[]) { // main almost exclusively does parameter pro
                 std::cerr << "--commands option requires one argument." << std::endl;
                 return 1;
             }  
+        } else if ((arg == "-p") || (arg == "--precision")) {
+            if (i + 1 < argc) { // make sure we aren't at the end of argv
+                precision = argv[++i];
+            } else {
+                std::cerr << "--precision option requires one argument." << std::endl;
+                return 1;
+            }
+            if (precision != "float" && precision != "double") {
+                std::cerr << "--precision must be float or double." << std::endl;
+                return 1;
+            }
+        } else if ((arg == "-s") || (arg == "--seed")) {
+            if (i + 1 < argc) { // make sure we aren't at the end of argv
+                seed = std::stoull(argv[++i]);
+            } else {
+                std::cerr << "--seed option requires one argument." << std::endl;
+                return 1;
+            }
+        } else if ((arg == "-w") || (arg == "--workers")) {
+            if (i + 1 < argc) { // make sure we aren't at the end of argv
+                workers = std::stoi(argv[++i]);
+            } else {
+                std::cerr << "--workers option requires one argument." << std::endl;
+                return 1;
+            }
         } else {
             // sources.push_back(argv[i]);
             if (i + 1 < argc) {
@@ -84,7 +117,12 @@ int main(int argc, char* argv[]) { // main almost exclusively does parameter pro
         return 1;
     }
 
-    engage(structureFile, weightsFile, commandsFile, runningAsChild);
+    seedRandom(seed); // seed the prng
+    if (precision == "float") {
+        engage<float>(structureFile, weightsFile, commandsFile, runningAsChild, workers);
+    } else {
+        engage<double>(structureFile, weightsFile, commandsFile, runningAsChild, workers);
+    }
 
     return 0;
 }
\ No newline at end of file
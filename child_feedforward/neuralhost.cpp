@@ -3,10 +3,75 @@
 ///////////////////////////////////////////////////////////////
 
 #include "neuralhost.h"
+#define COMPILED_KERNEL_SIGMOID // a linked compiled network uses the same sigmoid as the dynamic one
+#include "compiled.h"
 #include <math.h>
+#include <iomanip>
+#include <limits>
 
-NeuralHost::NeuralHost(char *nstructurepath, char *nweightspath) {
-    srand(time(NULL)); // seed the prng
+#ifdef COMPILED_NETWORK
+#include COMPILED_NETWORK // a header written by the compile command, see "make compiled"
+
+/// true when the linked compiled network has the same inputs, outputs, layers and weights as network
+template <typename Scalar>
+static bool matchesCompiledNetwork(const NeuralNet<Scalar> &network) {
+    typedef compiled_network::Scalar CompiledScalar;
+    const std::vector<NeuronLayer> &layers = network.getLayers();
+    if (network.getInputs().size() != compiled_network::numInputs || network.getOutputs().size() != compiled_network::numOutputs || layers.size() != compiled_network::numLayers) return false;
+    for (int i = 0; i < compiled_network::numInputs; i++) if (network.getInputs()[i] != compiled_network::inputNames[i]) return false;
+    for (int i = 0; i < compiled_network::numOutputs; i++) if (network.getOutputs()[i] != compiled_network::outputNames[i]) return false;
+    
+    Span<const Scalar> parameters = network.getWeights();
+    for (int i = 0; i < layers.size(); i++) {
+        const NeuronLayer &layer = layers[i];
+        if (layer.numNeurons != compiled_network::layerNeurons[i] || layer.numInputsPerNeuron != compiled_network::layerInputs[i]) return false;
+        for (int j = 0; j < layer.numNeurons; j++) {
+            for (int k = 0; k < layer.numInputsPerNeuron; k++) { // compiled weights are transposed
+                if ((CompiledScalar)parameters[layer.offset + (size_t)j * layer.numInputsPerNeuron + k] != compiled_network::layerWeights[i][(size_t)k * layer.numNeurons + j]) return false;
+            }
+            if ((CompiledScalar)parameters[layer.biasOffset() + j] != compiled_network::layerBiases[i][j]) return false;
+        }
+    }
+    return true;
+}
+
+/// propagates through the linked compiled network, converting to and from its scalar type on the stack
+template <typename Scalar>
+static void propagateCompiled(const std::vector<Scalar> &inputs, std::vector<Scalar> &outputs) {
+    compiled_network::Scalar compiledInputs[compiled_network::numInputs], compiledOutputs[compiled_network::numOutputs];
+    std::copy(inputs.begin(), inputs.end(), compiledInputs);
+    compiled_network::propagate(compiledInputs, compiledOutputs);
+    std::copy(compiledOutputs, compiledOutputs + compiled_network::numOutputs, outputs.begin());
+}
+#else
+template <typename Scalar>
+static void propagateCompiled(const std::vector<Scalar> &, std::vector<Scalar> &) {}
+#endif
+
+template <typename Scalar>
+NeuralHost<Scalar>::NeuralHost(char *nstructurepath, char *nweightspath) {
+    resolvedVersion = -1;
+    calibrationCount = 0;
+    compiledVersion = -1;
+    parallelMinimumWidth = PARALLEL_MIN_WIDTH;
+    trainingThreads = ThreadPool::hardwareThreads();
+    selection = SelectionRoulette;
+    selectionSize = 2;
+    crossover = CrossoverSinglePoint;
+    blendAlpha = 0.5;
+    abortBelowElite = false;
+    abortPercentile = -1;
+    trainingWorkers = 0;
+    checkpointGenerations = 50;
+    checkpointSeconds = 600;
+    streamBudget = 0;
+    miniBatchSize = 0;
+    miniBatchGrowth = 1;
+    miniBatchValidation = 10;
+    islandCount = 1;
+    migrationInterval = 10;
+    migrants = 2;
+    migration = MigrationRing;
     
     structurepath = nstructurepath;
     weightspath = nweightspath;
@@ -18,6 +83,14 @@ NeuralHost::NeuralHost(char *nstructurepath, char *nweightspath) {
             readWeightsFile();
         }
     }
+#ifdef COMPILED_NETWORK
+    if (matchesCompiledNetwork(neuralnet)) {
+        compiledVersion = neuralnet.getStructureVersion();
+        std::cout << "Using the compiled network from " << COMPILED_NETWORK << std::endl;
+    } else {
+        std::cerr << "The compiled network " << COMPILED_NETWORK << " does not match " << structurepath << ", using the dynamic network" << std::endl;
+    }
+#endif
     
     // make sure the provided files are writable
     if (!( access(structurepath, W_OK) != -1 && access(weightspath, W_OK) != -1 )) {
@@ -25,56 +98,109 @@ NeuralHost::NeuralHost(char *nstructurepath, char *nweightspath) {
     }
 }
 
-void NeuralHost::update() {
-    // Configure default inputs
-    std::vector<double> inputs;
-    std::vector<std::string> inputNames = neuralnet.getInputs();
-    int size = inputNames.size();
-    for (int i = 0; i < size; i++) {
-        inputs.push_back(0);
+/// reads a whole file into buffer, growing it only when the file no longer fits, returns the number of bytes read or -1
+static ssize_t readWholeFile(const char *path, std::vector<char> &buffer) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    size_t used = 0;
+    while (true) {
+        if (used == buffer.size()) buffer.resize(std::max<size_t>(4096, buffer.size() * 2));
+        ssize_t n = read(fd, &buffer[used], buffer.size() - used);
+        if (n <= 0) break;
+        used += n;
     }
+    close(fd);
+    return used;
+}
+
+template <typename Scalar>
+void NeuralHost<Scalar>::resolveInputMappings() {
+    const std::vector<std::string> &inputNames = neuralnet.getInputs();
+    resolvedMappings.clear();
+    for (const std::pair<const std::string, std::map<std::string, std::string>> &fileentry : inputMappings) {
+        ResolvedInputFile file;
+        file.path = fileentry.first;
+        for (const std::pair<const std::string, std::string> &otoi : fileentry.second) { // go through the mappings for this file
+            int pos = std::find(inputNames.begin(), inputNames.end(), otoi.second) - inputNames.begin(); // get the neural net's input index for the input name
+            if (pos < inputNames.size()) {
+                file.outputs.push_back(std::pair<std::string, int>(otoi.first, pos));
+            } else {
+                std::cerr << "No input named '" << otoi.second << "' exists." << std::endl;
+            }
+        }
+        resolvedMappings.push_back(file);
+    }
+    
+    // size every buffer update() needs for this structure
+    const std::vector<std::string> &outputNames = neuralnet.getOutputs();
+    updateInputs.assign(inputNames.size(), 0);
+    updateOutputs.assign(outputNames.size(), 0);
+    size_t textSize = 1;
+    for (const std::string &name : outputNames) textSize += name.size() + 32; // room for " value\n"
+    outputText.assign(textSize, 0);
+    if (inputText.empty()) inputText.resize(4096);
+    resolvedVersion = neuralnet.getStructureVersion();
+}
+
+template <typename Scalar>
+void NeuralHost<Scalar>::update() {
+    if (resolvedVersion != neuralnet.getStructureVersion()) resolveInputMappings(); // structure or mappings changed since the last update
+    
+    // Configure default inputs, unmapped / unfilled inputs are zero
+    std::fill(updateInputs.begin(), updateInputs.end(), 0);
     
     // Read inputs
-    for (std::pair<std::string, std::map<std::string, std::string>> fileentry : inputMappings) {
-        // read input file
-        std::map<std::string, double> fileoutputs;
-        std::ifstream inputfile(fileentry.first);
-        std::string line;
-        while (std::getline(inputfile, line)) {
-			if (line.length() > 0) { // ignore blank lines
-                std::stringstream ss(line);
-                std::string first;
-                double second;
-                ss >> first >> second;
-                fileoutputs[first] = second;
-			}
-		}
-        inputfile.close();
+    for (const ResolvedInputFile &file : resolvedMappings) {
+        ssize_t length = readWholeFile(file.path.c_str(), inputText);
+        if (length < 0) continue;
         
-        // set appropriate inputs
-        for (std::pair<std::string, std::string> otoi : fileentry.second) { // go through the mappings for this file
-           int pos = std::find(inputNames.begin(), inputNames.end(), otoi.second) - inputNames.begin(); // get the neural net's input index for the input name
-           if (pos < inputNames.size()) {
-               inputs[pos] = fileoutputs[otoi.first];
-           } else {
-               std::cerr << "No input named '" << otoi.second << "' exists." << std::endl;
-           }
+        // each line is "outputname value", set the inputs mapped to this file's outputs
+        const char *cursor = inputText.data(), *end = inputText.data() + length;
+        while (cursor < end) {
+            const char *lineEnd = (const char *)memchr(cursor, '\n', end - cursor);
+            if (!lineEnd) lineEnd = end;
+            const char *name = cursor;
+            while (name < lineEnd && isspace(*name)) name++;
+            const char *nameEnd = name;
+            while (nameEnd < lineEnd && !isspace(*nameEnd)) nameEnd++;
+            if (nameEnd > name) { // ignore blank lines
+                char number[64];
+                size_t numberLength = std::min<size_t>(lineEnd - nameEnd, sizeof(number) - 1);
+                memcpy(number, nameEnd, numberLength);
+                number[numberLength] = '\0';
+                double value = strtod(number, NULL);
+                for (const std::pair<std::string, int> &mapping : file.outputs) {
+                    if (mapping.first.size() == (size_t)(nameEnd - name) && memcmp(mapping.first.data(), name, nameEnd - name) == 0) {
+                        updateInputs[mapping.second] = value;
+                    }
+                }
+            }
+            cursor = lineEnd + 1;
         }
     }
     
     // Propagate and save outputs
-    std::vector<double> outputs = neuralnet.propagate(inputs);
-    std::vector<std::string> outputNames = neuralnet.getOutputs();
-    std::ofstream outputsfile(outputFile);
-    int i = 0;
-    for (double output : outputs) {
-        outputsfile << outputNames[i] << " " << output << std::endl;
-        i++;
+    if (!quantizednet.empty() && quantizednet.isStaleFor(neuralnet)) {
+        std::cerr << "Network structure changed, leaving quantized mode" << std::endl;
+        quantizednet.clear();
+    }
+    if (compiledVersion == neuralnet.getStructureVersion()) propagateCompiled(updateInputs, updateOutputs);
+    else if (!quantizednet.empty()) quantizednet.propagate(updateInputs, updateOutputs);
+    else neuralnet.propagate(updateInputs, updateOutputs);
+    const std::vector<std::string> &outputNames = neuralnet.getOutputs();
+    size_t used = 0;
+    for (int i = 0; i < updateOutputs.size(); i++) {
+        used += snprintf(&outputText[used], outputText.size() - used, "%s %g\n", outputNames[i].c_str(), updateOutputs[i]);
+    }
+    int fd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, outputText.data(), used) != (ssize_t)used) std::cerr << "Could not write outputs to " << outputFile << std::endl;
+        close(fd);
     }
-    outputsfile.close();
 }
 
-void NeuralHost::runCoordinatorCommand() {
+template <typename Scalar>
+void NeuralHost<Scalar>::runCoordinatorCommand() {
     // std::cout << std::endl;
     pid_t mypid = getpid();
     // std::ifstream commandfile(TMP_DIR + std::to_string(mypid) + ".command");
@@ -100,11 +226,13 @@ void synch_signal(int sig) {
 }
 
 
-void NeuralHost::runAsChild() {
+template <typename Scalar>
+void NeuralHost<Scalar>::runAsChild() {
     runAsChildInterruptHandler();
 }
 
-void NeuralHost::runAsChildInterruptHandler() {
+template <typename Scalar>
+void NeuralHost<Scalar>::runAsChildInterruptHandler() {
     // struct sigaction usr_action;
     // sigset_t block_mask;
     // pid_t child_id;
@@ -146,7 +274,8 @@ void NeuralHost::runAsChildInterruptHandler() {
     runAsChildInterruptHandler(); // wait for next interrupt
 }
 
-void NeuralHost::runWithREPL() {
+template <typename Scalar>
+void NeuralHost<Scalar>::runWithREPL() {
     std::cout << "\033[0;37mChild REPL:\033[0m" << std::endl;
     std::string line;
     std::cout << "\033[0;37m%\033[0m ";
@@ -166,7 +295,8 @@ void NeuralHost::runWithREPL() {
     }
 }
 
-bool NeuralHost::runCommands(char *filepath) {
+template <typename Scalar>
+bool NeuralHost<Scalar>::runCommands(char *filepath) {
     bool status = true; // success until a command fails
     std::ifstream infile(filepath);
     std::string line;
@@ -187,7 +317,8 @@ bool NeuralHost::runCommands(char *filepath) {
     return status;
 }
 
-void NeuralHost::printSummary(std::string prefix) {
+template <typename Scalar>
+void NeuralHost<Scalar>::printSummary(std::string prefix) {
     std::cout << prefix << "----------------" << std::endl;
     std::cout << prefix << "Outputs:" << std::endl;
     if (neuralnet.getOutputs().size() > 0) {
@@ -200,7 +331,7 @@ void NeuralHost::printSummary(std::string prefix) {
     std::cout << prefix << "Hidden Layers:" << std::endl;
     if (neuralnet.getLayers().size() > 1) {
         for (int i = neuralnet.getLayers().size()-2; i > -1; i--)
-            std::cout << prefix << "  " << i+1 << ": (x" << neuralnet.getLayers()[i].neurons.size() << ") " << std::endl;
+            std::cout << prefix << "  " << i+1 << ": (x" << neuralnet.getLayers()[i].numNeurons << ") " << std::endl;
     } else {
         std::cout << prefix << "  none" << std::endl;
     }
@@ -215,7 +346,8 @@ void NeuralHost::printSummary(std::string prefix) {
     std::cout << prefix << "----------------" << std::endl;
 }
 
-void NeuralHost::printStats(std::string prefix) {
+template <typename Scalar>
+void NeuralHost<Scalar>::printStats(std::string prefix) {
     std::cout << prefix << "----------------" << std::endl;
     std::cout << prefix << "Neurons: " << std::endl;
     if (neuralnet.getLayers().size() > 0 || neuralnet.getOutputs().size() > 0) {
@@ -244,141 +376,706 @@ void NeuralHost::printStats(std::string prefix) {
 
 
 
+/// what every generation of a training run shares: the samples, a block of networks and an output buffer per thread, the
+/// early abort settings, and counters every thread adds to
+template <typename Scalar>
+struct TrainingRun {
+	std::vector<NeuralNet<Scalar>> networks; ///< block per part, so no two threads share weights or activation buffers
+	int block; ///< chromosomes a part scores side by side, EVALUATION_BLOCK unless their weights would pass EVALUATION_BLOCK_BYTES
+	std::vector<std::vector<Scalar>> outputs; ///< network outputs for a tile of training samples (a batch of them when streaming), one buffer per part
+	int tileSamples; ///< samples a block of chromosomes is scored on before moving to the next, so they stay in cache
+	const Scalar *inputs; ///< row-major, a sample per row, NULL when streaming
+	const Scalar *expected;
+	DatasetStream<Scalar> *stream; ///< reads the samples a chunk at a time when set, every generation is then scored chunk by chunk
+	int count; ///< training samples
+	bool abortBelowElite;
+	double abortPercentile;
+	std::atomic<long> evaluations, reused;
+	std::atomic<long> aborted; ///< chromosomes that stopped early
+	std::atomic<long> samples; ///< samples evaluated, over every chromosome
+	WorkerFarm *farm; ///< scores every generation in worker processes when set, the islands then evolve on the calling thread
+	std::vector<int> pending; ///< the chromosomes of a generation handed to the farm or streamed, and their scores so far
+	std::vector<const char *> pendingChromosomes;
+	std::vector<double> pendingFitness;
+	std::vector<char> pendingExact;
+	std::vector<int> pendingDone; ///< samples each streamed chromosome was evaluated on, it stopped early once short of those streamed
+	int batchSize; ///< samples in each generation's mini-batch, 0 (or run.count and up) to score on every sample
+	uint64_t batchSeed; ///< generation g draws its mini-batch from Random(batchSeed, g), so every island scores on the same one
+	std::vector<std::vector<int>> batchIndices; ///< the current mini-batch of each island, and its samples gathered
+	std::vector<std::vector<Scalar>> batchInputs, batchExpected;
+	std::vector<char> batchScored; ///< set for each island whose current scores were taken on a mini-batch rather than every sample
+	std::atomic<long> offered; ///< samples the evaluations would have covered without early abort
+	
+	NeuralNet<Scalar> &network(int part, int c = 0) { return networks[part * block + c]; }
+};
+
+/// one generation's fitness evaluation, as handed to the thread pool
+template <typename Scalar>
+struct FitnessJob {
+	TrainingRun<Scalar> *run;
+	Genetic<Scalar> *genalg;
+	const Scalar *inputs, *expected; ///< the samples to score on, every training sample or the generation's mini-batch
+	int count;
+	double cutoff; ///< chromosomes sure to score below this stop being evaluated, -infinity to evaluate every one in full
+	int block; ///< chromosomes parts take at a time, at most TrainingRun::block and few enough that uneven timings even out
+	std::atomic<int> next; ///< the first chromosome of the next block to evaluate
+};
+
+/// adds the fitness of count consecutive training samples to a chromosome's, whose weights network holds: the sum over every
+/// output of 1 - |output - expected|. Samples go through the network up to batch at a time, and done counts them; with a
+/// cutoff, evaluation stops once the chromosome is sure to score below it over all total samples, returning false.
+template <typename Scalar>
+static bool accumulateFitness(NeuralNet<Scalar> &network, std::vector<Scalar> &outputs, const Scalar *inputs, const Scalar *expected, int count, int total, int batch, double cutoff, double &fitness, int &done) {
+	const int inputCount = network.getInputs().size(), outputCount = network.getOutputs().size();
+	for (int first = 0; first < count; first += batch) {
+		// run the next samples through the network in one batch
+		int samples = std::min(batch, count - first);
+		network.propagateBatch(Span<const Scalar>(inputs + (size_t)first * inputCount, (size_t)samples * inputCount), samples, Span<Scalar>(outputs.data(), (size_t)samples * outputCount));
+		
+		// adjust the fitness given each sample, currently all outputs are considered equally
+		const Scalar *sampleExpected = expected + (size_t)first * outputCount;
+		for (int j = 0; j < samples * outputCount; j++) {
+			fitness += 1 - fabs(outputs[j] - sampleExpected[j]); // use a simple difference to get the fitness, TODO: eventually have the option to 
+		}
+		done += samples;
+		
+		// every remaining output adds at most 1, stop once even that falls short
+		if (done < total && fitness + (double)(total - done) * outputCount < cutoff) return false;
+	}
+	return true;
+}
+
+/// scores up to run.block chromosomes side by side on the given part's block of networks over count samples, see
+/// accumulateFitness(): every chromosome of the block goes through a tile of samples before the next tile, so the tile is
+/// read from memory once for the block and stays in cache while each network's weights are used on it. Each fitness adds
+/// up its samples in the same order as scoring the chromosome on its own would. With a cutoff, samples are evaluated
+/// EARLY_ABORT_SAMPLES at a time and a chromosome may stop early; its done is then short of count and its fitness an
+/// estimate extrapolated from the samples seen.
+template <typename Scalar>
+static void evaluateBlock(TrainingRun<Scalar> &run, int part, const Scalar *const *genes, int chromosomes, const Scalar *inputs, const Scalar *expected, int count, double cutoff, double *fitness, int *done) {
+	const int numweights = run.network(part).getNumberOfWeights();
+	const int inputCount = run.network(part).getInputs().size(), outputCount = run.network(part).getOutputs().size();
+	bool going[EVALUATION_BLOCK];
+	for (int c = 0; c < chromosomes; c++) {
+		run.network(part, c).setWeights(Span<const Scalar>(genes[c], numweights));
+		fitness[c] = 0;
+		done[c] = 0;
+		going[c] = true;
+	}
+	const int batch = cutoff > -INFINITY ? EARLY_ABORT_SAMPLES : run.tileSamples; // tiles are a multiple of EARLY_ABORT_SAMPLES
+	for (int first = 0; first < count; first += run.tileSamples) {
+		int samples = std::min(run.tileSamples, count - first);
+		for (int c = 0; c < chromosomes; c++) {
+			if (going[c]) going[c] = accumulateFitness(run.network(part, c), run.outputs[part], inputs + (size_t)first * inputCount, expected + (size_t)first * outputCount, samples, count, batch, cutoff, fitness[c], done[c]);
+		}
+	}
+	for (int c = 0; c < chromosomes; c++) {
+		if (done[c] < count) fitness[c] = fitness[c] * count / std::max(1, done[c]); // the extrapolation stays below the cutoff
+	}
+}
+
+/// scores one chromosome on the given part's first network over count samples, see evaluateBlock()
+template <typename Scalar>
+static double evaluateChromosome(TrainingRun<Scalar> &run, int part, Span<const Scalar> genes, const Scalar *inputs, const Scalar *expected, int count, double cutoff, int &done) {
+	const Scalar *chromosome = genes.data();
+	double fitness;
+	evaluateBlock(run, part, &chromosome, 1, inputs, expected, count, cutoff, &fitness, &done);
+	return fitness;
+}
+
+/// the block FitnessJob parts take: run.block, or fewer so each of parts gets about four blocks of the population
+template <typename Scalar>
+static int evaluationBlock(const TrainingRun<Scalar> &run, int populationSize, int parts) {
+	return std::max(1, std::min(run.block, populationSize / (4 * parts)));
+}
+
+/// ThreadPool::Task for a FitnessJob: each part takes a block of the population at a time and scores the chromosomes in it
+/// that need it side by side, until none are left, writing only the fitness of the chromosomes it took
+template <typename Scalar>
+static void evaluateFitnessTask(void *context, int part, int parts) {
+	FitnessJob<Scalar> &job = *(FitnessJob<Scalar> *)context;
+	TrainingRun<Scalar> &run = *job.run;
+	const int populationSize = job.genalg->getPopulationSize();
+	for (int first = job.next.fetch_add(job.block); first < populationSize; first = job.next.fetch_add(job.block)) {
+		const Scalar *genes[EVALUATION_BLOCK];
+		int indices[EVALUATION_BLOCK], chromosomes = 0;
+		for (int i = first; i < std::min(first + job.block, populationSize); i++) {
+			if (!job.genalg->needsEvaluation(i)) continue; // an unchanged copy of a scored parent, its fitness carried over
+			genes[chromosomes] = job.genalg->getGenes(i).data();
+			indices[chromosomes++] = i;
+		}
+		double fitness[EVALUATION_BLOCK];
+		int done[EVALUATION_BLOCK];
+		evaluateBlock(run, part, genes, chromosomes, job.inputs, job.expected, job.count, job.cutoff, fitness, done);
+		for (int c = 0; c < chromosomes; c++) {
+			run.samples += done[c];
+			run.aborted += done[c] < job.count;
+			job.genalg->setFitness(indices[c], fitness[c], done[c] == job.count);
+		}
+	}
+}
+
+/// collects the chromosomes of genalg that need evaluating into run's pending lists
+template <typename Scalar>
+static void collectPending(TrainingRun<Scalar> &run, Genetic<Scalar> &genalg) {
+	run.pending.clear();
+	run.pendingChromosomes.clear();
+	for (int i = 0; i < genalg.getPopulationSize(); i++) {
+		if (!genalg.needsEvaluation(i)) continue;
+		run.pending.push_back(i);
+		run.pendingChromosomes.push_back((const char *)genalg.getGenes(i).data());
+	}
+	run.pendingFitness.assign(run.pending.size(), 0);
+	run.pendingExact.assign(run.pending.size(), 1);
+}
+
+/// scores the chromosomes of genalg that need it across run's worker farm
+template <typename Scalar>
+static void evaluateOnFarm(TrainingRun<Scalar> &run, Genetic<Scalar> &genalg, double cutoff) {
+	collectPending(run, genalg);
+	run.samples += run.farm->evaluate(run.pendingChromosomes, cutoff, run.pendingFitness.data(), run.pendingExact.data());
+	for (size_t j = 0; j < run.pending.size(); j++) {
+		genalg.setFitness(run.pending[j], run.pendingFitness[j], run.pendingExact[j]);
+		run.aborted += !run.pendingExact[j];
+	}
+}
+
+/// one chunk of streamed samples, as handed to the thread pool
+template <typename Scalar>
+struct ChunkJob {
+	TrainingRun<Scalar> *run;
+	Genetic<Scalar> *genalg;
+	const Scalar *inputs, *expected;
+	int count; ///< samples in the chunk
+	double cutoff; ///< as FitnessJob::cutoff
+	std::atomic<int> next; ///< the next pending chromosome to evaluate
+};
+
+/// ThreadPool::Task for a ChunkJob: each part takes pending chromosomes one at a time and adds the chunk to their fitness
+template <typename Scalar>
+static void evaluateChunkTask(void *context, int part, int parts) {
+	ChunkJob<Scalar> &job = *(ChunkJob<Scalar> *)context;
+	TrainingRun<Scalar> &run = *job.run;
+	const int batch = job.cutoff > -INFINITY ? EARLY_ABORT_SAMPLES : STREAM_BATCH_SAMPLES;
+	for (int j = job.next++; j < (int)run.pending.size(); j = job.next++) {
+		if (!run.pendingExact[j]) continue; // stopped in an earlier chunk
+		run.network(part).setWeights(Span<const Scalar>(job.genalg->getGenes(run.pending[j])));
+		run.pendingExact[j] = accumulateFitness(run.network(part), run.outputs[part], job.inputs, job.expected, job.count, run.count, batch, job.cutoff, run.pendingFitness[j], run.pendingDone[j]);
+	}
+}
+
+/// scores the chromosomes of genalg that need it with run's stream, reading the samples once for all of them: each chunk is
+/// scored across pool while the stream reads the next. Chunks are a multiple of the batches, so every chromosome sees the
+/// same batches and stops at the same sample as when evaluated over all samples at once. Returns false, leaving the scores
+/// alone, when the stream could not be read.
+template <typename Scalar>
+static bool evaluateStreamed(TrainingRun<Scalar> &run, Genetic<Scalar> &genalg, double cutoff, ThreadPool *pool, int part) {
+	collectPending(run, genalg);
+	run.pendingDone.assign(run.pending.size(), 0);
+	ChunkJob<Scalar> job;
+	job.run = &run;
+	job.genalg = &genalg;
+	job.cutoff = cutoff;
+	while (run.stream->next(job.inputs, job.expected, job.count)) {
+		job.next = 0;
+		if (pool) pool->run(evaluateChunkTask<Scalar>, &job);
+		else evaluateChunkTask<Scalar>(&job, part, 1);
+	}
+	if (run.stream->failed()) return false; // not the end of a pass, the chunks left were never scored
+	for (size_t j = 0; j < run.pending.size(); j++) {
+		int done = std::max(1, run.pendingDone[j]);
+		double fitness = run.pendingFitness[j];
+		genalg.setFitness(run.pending[j], done < run.count ? fitness * run.count / done : fitness, done == run.count); // extrapolated as in evaluateBlock()
+		run.samples += run.pendingDone[j];
+		run.aborted += done < run.count;
+	}
+	return true;
+}
+
+/// draws the given generation's mini-batch of run.batchSize training samples, with replacement, into island's buffers
+template <typename Scalar>
+static void drawMiniBatch(TrainingRun<Scalar> &run, int island, int generation) {
+	const int inputCount = run.network(0).getInputs().size(), outputCount = run.network(0).getOutputs().size();
+	Random random(run.batchSeed, generation);
+	std::vector<int> &indices = run.batchIndices[island];
+	indices.resize(run.batchSize);
+	for (int &index : indices) index = random.range(0, run.count - 1);
+	std::sort(indices.begin(), indices.end()); // read in file order, kinder to the page cache when the set is mapped
+	
+	std::vector<Scalar> &inputs = run.batchInputs[island], &expected = run.batchExpected[island];
+	inputs.resize((size_t)run.batchSize * inputCount);
+	expected.resize((size_t)run.batchSize * outputCount);
+	for (int i = 0; i < run.batchSize; i++) {
+		std::copy_n(run.inputs + (size_t)indices[i] * inputCount, inputCount, inputs.begin() + (size_t)i * inputCount);
+		std::copy_n(run.expected + (size_t)indices[i] * outputCount, outputCount, expected.begin() + (size_t)i * outputCount);
+	}
+}
+
+/// breeds genalg's next generation and scores it, split across pool or, without one, entirely on the given part. With
+/// mini-batches, the whole generation is scored on the one drawn for it. Returns false when streamed samples could not be read.
+template <typename Scalar>
+static bool evolve(TrainingRun<Scalar> &run, Genetic<Scalar> &genalg, int island, int generation, ThreadPool *pool, int part) {
+	genalg.runEpoch();
+	FitnessJob<Scalar> job = { &run, &genalg, run.inputs, run.expected, run.count, -INFINITY, evaluationBlock(run, genalg.getPopulationSize(), pool ? pool->size() : 1), {0} };
+	bool batched = run.batchSize > 0 && run.batchSize < run.count;
+	if (batched) {
+		drawMiniBatch(run, island, generation);
+		job.inputs = run.batchInputs[island].data();
+		job.expected = run.batchExpected[island].data();
+		job.count = run.batchSize;
+	}
+	if (batched || run.batchScored[island]) genalg.invalidateFitness(); // scores on the last batch do not compare with scores on this one, nor with sums over every sample once the batch has grown to all of them
+	run.batchScored[island] = batched;
+	long evaluations = 0;
+	for (int i = 0; i < genalg.getPopulationSize(); i++) evaluations += genalg.needsEvaluation(i);
+	run.evaluations += evaluations;
+	run.reused += genalg.getPopulationSize() - evaluations;
+	run.offered += evaluations * job.count;
+	
+	// evaluate the population
+	double cutoff = -INFINITY;
+	if (run.abortBelowElite) cutoff = genalg.getEliteCutoff();
+	if (run.abortPercentile >= 0 && generation > 0) cutoff = std::max(cutoff, genalg.getPercentileCutoff());
+	job.cutoff = cutoff;
+	if (run.farm) evaluateOnFarm(run, genalg, cutoff);
+	else if (run.stream) return evaluateStreamed(run, genalg, cutoff, pool, part);
+	else if (pool) pool->run(evaluateFitnessTask<Scalar>, &job);
+	else evaluateFitnessTask<Scalar>(&job, part, 1);
+	return true;
+}
+
+/// the generations between two migrations, as handed to the thread pool
+template <typename Scalar>
+struct IslandJob {
+	TrainingRun<Scalar> *run;
+	IslandModel<Scalar> *islands;
+	int generation; ///< the first generation to breed
+	int generations;
+	std::atomic<int> next; ///< the next island to evolve
+};
+
+/// ThreadPool::Task for an IslandJob: each part takes whole islands, one at a time, and evolves each through every
+/// generation of the job on its own, without waiting on the other parts
+template <typename Scalar>
+static void evolveIslandsTask(void *context, int part, int parts) {
+	IslandJob<Scalar> &job = *(IslandJob<Scalar> *)context;
+	for (int k = job.next++; k < job.islands->getNumberOfIslands(); k = job.next++) {
+		for (int generation = job.generation; generation < job.generation + job.generations; generation++) {
+			evolve(*job.run, job.islands->getIsland(k), k, generation, (ThreadPool *)NULL, part);
+		}
+	}
+}
+
+#define CHECKPOINT_MAGIC 0x32544b434e4e45ULL ///< "ENNCKT2", the first eight bytes of every checkpoint
+#define CHECKPOINT_MAGIC_V1 0x31544b434e4e45ULL ///< "ENNCKT1", a checkpoint from before mini-batches, still resumed
+
+/// TrainingCheckpoint is what a checkpoint records about its training run besides the population: enough to pick the run
+/// up where it stopped with the same data, settings and counters
+struct TrainingCheckpoint {
+	std::string trainname, testname;
+	std::string activation; ///< the Activation fitness was evaluated with
+	int32_t scalarBytes; ///< sizeof(Scalar), a checkpoint only resumes at the precision it was written at
+	int32_t numweights;
+	int32_t popsize, generations;
+	int32_t generation; ///< the next generation to breed
+	int32_t islands, migrationInterval;
+	char abortBelowElite;
+	double abortPercentile;
+	int64_t evaluations, reused, aborted, samples;
+	double elapsed; ///< seconds spent training before this checkpoint, over every run that led to it
+	int32_t batchSize; ///< the mini-batch size reached, 0 without mini-batches
+	int32_t batchValidation;
+	double batchGrowth;
+	uint64_t batchSeed;
+	double bestValidated; ///< the best fitness on every sample a validation has seen
+	int64_t offered;
+	char batchScored; ///< the last generation was scored on a mini-batch, even when the batch has since grown to every sample
+};
+
+/// writes the header and population of a checkpoint to path + ".partial" and renames it over path once complete, so path
+/// always holds a whole checkpoint even when the process dies midway
+template <typename Scalar>
+static bool writeCheckpoint(std::string path, const TrainingCheckpoint &checkpoint, const IslandModel<Scalar> &islands) {
+	std::string partial = path + ".partial";
+	{
+		std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+		writeBinary(out, (uint64_t)CHECKPOINT_MAGIC);
+		writeBinary(out, checkpoint.trainname);
+		writeBinary(out, checkpoint.testname);
+		writeBinary(out, checkpoint.activation);
+		writeBinary(out, checkpoint.scalarBytes);
+		writeBinary(out, checkpoint.numweights);
+		writeBinary(out, checkpoint.popsize);
+		writeBinary(out, checkpoint.generations);
+		writeBinary(out, checkpoint.generation);
+		writeBinary(out, checkpoint.islands);
+		writeBinary(out, checkpoint.migrationInterval);
+		writeBinary(out, checkpoint.abortBelowElite);
+		writeBinary(out, checkpoint.abortPercentile);
+		writeBinary(out, checkpoint.evaluations);
+		writeBinary(out, checkpoint.reused);
+		writeBinary(out, checkpoint.aborted);
+		writeBinary(out, checkpoint.samples);
+		writeBinary(out, checkpoint.elapsed);
+		writeBinary(out, checkpoint.batchSize);
+		writeBinary(out, checkpoint.batchValidation);
+		writeBinary(out, checkpoint.batchGrowth);
+		writeBinary(out, checkpoint.batchSeed);
+		writeBinary(out, checkpoint.bestValidated);
+		writeBinary(out, checkpoint.offered);
+		writeBinary(out, checkpoint.batchScored);
+		islands.save(out);
+		out.flush();
+		if (!out) {
+			std::cerr << "ERROR: could not write the checkpoint " << partial << std::endl;
+			return false;
+		}
+	}
+	if (rename(partial.c_str(), path.c_str()) != 0) {
+		std::cerr << "ERROR: could not replace the checkpoint " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// reads a checkpoint's header, the population follows it, see IslandModel::load(). A version 1 checkpoint resumes without
+/// mini-batches, offered is then -1.
+static bool readCheckpoint(std::istream &in, TrainingCheckpoint &checkpoint) {
+	uint64_t magic;
+	checkpoint.batchSize = checkpoint.batchValidation = 0;
+	checkpoint.batchGrowth = 1;
+	checkpoint.batchSeed = 0;
+	checkpoint.bestValidated = -INFINITY;
+	checkpoint.offered = -1;
+	checkpoint.batchScored = 0;
+	return readBinary(in, magic) && (magic == CHECKPOINT_MAGIC || magic == CHECKPOINT_MAGIC_V1)
+		&& readBinary(in, checkpoint.trainname) && readBinary(in, checkpoint.testname) && readBinary(in, checkpoint.activation)
+		&& readBinary(in, checkpoint.scalarBytes) && readBinary(in, checkpoint.numweights)
+		&& readBinary(in, checkpoint.popsize) && readBinary(in, checkpoint.generations) && readBinary(in, checkpoint.generation)
+		&& readBinary(in, checkpoint.islands) && readBinary(in, checkpoint.migrationInterval)
+		&& readBinary(in, checkpoint.abortBelowElite) && readBinary(in, checkpoint.abortPercentile)
+		&& readBinary(in, checkpoint.evaluations) && readBinary(in, checkpoint.reused) && readBinary(in, checkpoint.aborted) && readBinary(in, checkpoint.samples)
+		&& readBinary(in, checkpoint.elapsed)
+		&& (magic == CHECKPOINT_MAGIC_V1 || (readBinary(in, checkpoint.batchSize) && readBinary(in, checkpoint.batchValidation) && readBinary(in, checkpoint.batchGrowth)
+			&& readBinary(in, checkpoint.batchSeed) && readBinary(in, checkpoint.bestValidated) && readBinary(in, checkpoint.offered) && readBinary(in, checkpoint.batchScored)));
+}
+
+/// set by SIGTERM while training writes checkpoints, so the run stops at the next checkpoint it can write
+volatile sig_atomic_t training_terminate = 0;
+void training_terminate_signal(int sig) {
+	training_terminate = 1;
+}
+
 /// TODO: this function could use heavy refactoring, consider breaking up into its own file or into neuralnet
-void NeuralHost::trainNetwork(std::string trainname, std::string testname, int popsize, int generations) {
-	clock_t begin = clock();
+template <typename Scalar>
+void NeuralHost<Scalar>::trainNetwork(std::string trainname, std::string testname, int popsize, int generations, int threads, Crossover crossoverMode, int islandCount, std::string resumepath) {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now(); // wall clock, clock() would add up every thread's time
+	
+	// A resumed run takes its data, sizes and settings from the checkpoint, the population follows once it is laid out
+	TrainingCheckpoint checkpoint;
+	std::ifstream resume;
+	bool abortElite = abortBelowElite;
+	double abortAt = abortPercentile;
+	std::string fitnessActivation = trainingActivation;
+	int interval = migrationInterval;
+	int batchSize = miniBatchSize, batchValidation = miniBatchValidation;
+	double batchGrowth = miniBatchGrowth;
+	if (resumepath != "") {
+		resume.open(resumepath, std::ios::binary);
+		if (!readCheckpoint(resume, checkpoint) || checkpoint.scalarBytes != sizeof(Scalar) || checkpoint.numweights != neuralnet.getNumberOfWeights()) {
+			std::cerr << "ERROR: " << resumepath << " is not a checkpoint of this network at this precision" << std::endl;
+			return;
+		}
+		trainname = checkpoint.trainname;
+		testname = checkpoint.testname;
+		popsize = checkpoint.popsize;
+		generations = checkpoint.generations;
+		islandCount = checkpoint.islands;
+		interval = checkpoint.migrationInterval;
+		abortElite = checkpoint.abortBelowElite;
+		abortAt = checkpoint.abortPercentile;
+		fitnessActivation = checkpoint.activation;
+		batchSize = checkpoint.batchSize;
+		batchValidation = checkpoint.batchValidation;
+		batchGrowth = checkpoint.batchGrowth;
+	}
 	
-	// Load training data
+	// Load training data, mini-batches are drawn from all of it (mapped, for a binary file) rather than streamed
 	int inputCount = neuralnet.getInputs().size();
 	int outputCount = neuralnet.getOutputs().size();
-	std::vector<std::pair<std::vector<double>, std::vector<double>>> trainingdata;
-	std::ifstream trainingfile(trainname);
-    std::string line;
-    while (std::getline(trainingfile, line)) {
-        if (line[0] != '#') { // ignore comments
-			if (line.length() > 0) { // ignore blank lines
-				std::vector<std::string> two_parts = string_split(line, ':');
-				std::vector<std::string> inputs_pre = string_split(two_parts[0], ' ');
-				std::vector<std::string> outputs_pre = string_split(two_parts[1], ' ');
-				
-				std::vector<double> inputs;
-				std::vector<double> outputs;
-				for (auto it = inputs_pre.begin(); it != inputs_pre.end(); ++it) {
-					try { inputs.push_back(stof(*it)); } catch (...) { }
-				}
-				for (auto it = outputs_pre.begin(); it != outputs_pre.end(); ++it) {
-					try { outputs.push_back(stof(*it)); } catch (...) { }
-				}
-				
-				if (inputs.size() != inputCount || outputs.size() != outputCount) {
-					std::cerr << "ERROR: Invalid training data file!" << std::endl;
-					break;
-				}
-				
-				trainingdata.push_back(std::pair<std::vector<double>, std::vector<double>>(inputs, outputs));
-            }
-        }
-    }
+	Dataset<Scalar> training;
+	DatasetStream<Scalar> stream; // in place of training, for sets that do not fit in memory
+	bool streaming = streamBudget > 0 && batchSize == 0;
+	if (batchSize > 0 && (streamBudget > 0 || trainingWorkers > 0)) std::cout << "OUT: TRAINING: mini-batches are scored in this process, without streaming or workers" << std::endl;
+	if (streaming ? !stream.open(trainname, inputCount, outputCount, streamBudget, EARLY_ABORT_SAMPLES) : !training.load(trainname, inputCount, outputCount)) return;
+	int trainingCount = streaming ? stream.size() : training.size();
 	
-	// Setup training
+	// Setup training, the population starts out random
 	int numweights = neuralnet.getNumberOfWeights();
-	std::vector<Chromosome> population;
-	for (int i = 0; i < popsize; i++) {
-		population.push_back(Chromosome());
-		for (int j = 0; j < numweights; j++) {
-			population[i].genes.push_back(randomClamped());
+	islandCount = std::max(1, std::min(islandCount, popsize / 2));
+	IslandModel<Scalar> islands(islandCount, popsize, 0.1, 0.7, numweights, threadRandom().next());
+	uint64_t batchSeed = resumepath != "" ? checkpoint.batchSeed : batchSize > 0 ? threadRandom().next() : 0;
+	islands.setMigration(migration, migrants);
+	std::vector<int> groups; // for CrossoverNeuron, which a resumed run may use whatever crossoverMode says: a neuron's row of weights and its bias are one group, in getWeights() order
+	int neuron = 0;
+	for (const NeuronLayer &layer : neuralnet.getLayers()) {
+		for (int j = 0; j < layer.numNeurons; j++) groups.insert(groups.end(), layer.numInputsPerNeuron, neuron + j);
+		for (int j = 0; j < layer.numNeurons; j++) groups.push_back(neuron + j);
+		neuron += layer.numNeurons;
+	}
+	for (int k = 0; k < islandCount; k++) {
+		Genetic<Scalar> &genalg = islands.getIsland(k);
+		genalg.setSelection(selection, selectionSize);
+		genalg.setCrossover(crossoverMode, blendAlpha);
+		genalg.setCutoffPercentile(abortAt);
+		genalg.setGeneGroups(groups);
+	}
+	int firstGeneration = 0;
+	if (resumepath != "") {
+		if (!islands.load(resume)) {
+			std::cerr << "ERROR: the population in " << resumepath << " is damaged" << std::endl;
+			return;
 		}
+		firstGeneration = checkpoint.generation;
 	}
-	Genetic *genalg = new Genetic(popsize, 0.1, 0.7, numweights);
 	
-	// Iterate generations
-	for (int generation = 0; generation < generations; generation++) {
-		population = genalg->runEpoch(population);
-		
-		// iterate population
-		for (int i = 0; i < popsize; i++) {
-			neuralnet.setWeights(population[i].genes);
-			population[i].fitness = 0;
-			
-			// iterate training data samples
-			for (int sample = 0; sample < trainingdata.size(); sample++) {
-				std::vector<double> outputs = neuralnet.propagate(trainingdata[sample].first);
-			
-				// adjust the fitness given the current sample, currently all outputs are considered equally
-				double current_sample_fitness = 0;
-				for (int i = 0; i < outputs.size(); i++) {
-					current_sample_fitness += 1 - fabs(outputs[i] - trainingdata[sample].second[i]); // use a simple difference to get the fitness, TODO: eventually have the option to 
+	// Fitness only ranks chromosomes, so it can use a cheaper sigmoid than the one validation and update() use
+	Activation previousActivation = activation();
+	if (fitnessActivation != "") selectActivation(fitnessActivation);
+	
+	// Every evaluation thread gets its own copy of the network, copies evaluated side by side do not split their layers too.
+	// Streamed samples are read once a generation for every chromosome, so the islands take turns and each generation is
+	// scored across every thread, in this process.
+	bool farming = trainingWorkers > 0 && !streaming && batchSize == 0;
+	if (trainingWorkers > 0 && streaming) std::cout << "OUT: TRAINING: streaming scores in this process, not in workers" << std::endl;
+	threads = farming ? 1 : std::max(1, std::min(threads, islandCount > 1 && !streaming ? islandCount : popsize)); // worker processes do the scoring
+	TrainingRun<Scalar> run;
+	run.block = std::max(1, std::min<int>(EVALUATION_BLOCK, EVALUATION_BLOCK_BYTES / (numweights * sizeof(Scalar))));
+	run.networks.assign(threads * run.block, neuralnet);
+	if (farming || threads > 1) { // a forked worker has none of the REPL pool's threads to wait on
+		for (NeuralNet<Scalar> &network : run.networks) network.setThreadPool(NULL, parallelMinimumWidth);
+	}
+	int widest = 1; // a tile's samples fit KERNEL_L2_BYTES, and the activations every network of a block keeps for it EVALUATION_BLOCK_BYTES
+	for (const NeuronLayer &layer : neuralnet.getLayers()) widest = std::max(widest, layer.numNeurons);
+	size_t tile = std::min(KERNEL_L2_BYTES / ((inputCount + outputCount) * sizeof(Scalar)), EVALUATION_BLOCK_BYTES / ((size_t)run.block * 2 * widest * sizeof(Scalar)));
+	run.tileSamples = std::max<int>(1, tile / EARLY_ABORT_SAMPLES) * EARLY_ABORT_SAMPLES;
+	run.outputs.assign(threads, std::vector<Scalar>((size_t)std::max(run.tileSamples, STREAM_BATCH_SAMPLES) * outputCount)); // reused by every evaluation
+	run.inputs = streaming ? NULL : training.getInputs().data();
+	run.expected = streaming ? NULL : training.getOutputs().data();
+	run.stream = streaming ? &stream : NULL;
+	run.count = trainingCount;
+	run.batchSize = batchSize;
+	run.batchSeed = batchSeed;
+	run.batchIndices.resize(islandCount);
+	run.batchInputs.resize(islandCount);
+	run.batchExpected.resize(islandCount);
+	run.batchScored.assign(islandCount, resumepath != "" && checkpoint.batchScored);
+	run.abortBelowElite = abortElite;
+	run.abortPercentile = abortAt;
+	run.evaluations = run.reused = run.aborted = run.samples = run.offered = 0;
+	double bestValidated = -INFINITY;
+	if (resumepath != "") {
+		run.evaluations = checkpoint.evaluations;
+		run.reused = checkpoint.reused;
+		run.aborted = checkpoint.aborted;
+		run.samples = checkpoint.samples;
+		run.offered = checkpoint.offered >= 0 ? checkpoint.offered : checkpoint.evaluations * trainingCount;
+		bestValidated = checkpoint.bestValidated;
+	}
+	run.farm = NULL;
+	std::unique_ptr<WorkerFarm> farm;
+	if (farming) { // forked now, so every worker has the samples and the training activation
+		farm.reset(new WorkerFarm(trainingWorkers, numweights * sizeof(Scalar), [&run, numweights](const char *chromosomes, int count, double cutoff, double *fitness, char *exact) {
+			uint64_t samples = 0;
+			for (int first = 0; first < count; first += run.block) {
+				int block = std::min(run.block, count - first);
+				const Scalar *genes[EVALUATION_BLOCK];
+				int done[EVALUATION_BLOCK];
+				for (int c = 0; c < block; c++) genes[c] = (const Scalar *)chromosomes + (size_t)(first + c) * numweights;
+				evaluateBlock(run, 0, genes, block, run.inputs, run.expected, run.count, cutoff, fitness + first, done);
+				for (int c = 0; c < block; c++) {
+					exact[first + c] = done[c] == run.count;
+					samples += done[c];
 				}
-				population[i].fitness += current_sample_fitness;
 			}
-		}
-		
-//			std::cout << genalg->getBestFitness() << "\t" << genalg->getAverageFitness() << std::endl;
+			return samples;
+		}));
+		run.farm = farm.get();
 	}
+	ThreadPool pool(threads, true); // started once the workers are forked, so none of them inherits a pool it cannot run
+	
+	// Checkpoints are written between generations every checkpointGenerations or checkpointSeconds, and on SIGTERM
+	checkpoint.trainname = trainname;
+	checkpoint.testname = testname;
+	checkpoint.activation = activationName(activation());
+	checkpoint.scalarBytes = sizeof(Scalar);
+	checkpoint.numweights = numweights;
+	checkpoint.popsize = popsize;
+	checkpoint.generations = generations;
+	checkpoint.islands = islandCount;
+	checkpoint.migrationInterval = interval;
+	checkpoint.abortBelowElite = abortElite;
+	checkpoint.abortPercentile = abortAt;
+	checkpoint.batchValidation = batchValidation;
+	checkpoint.batchGrowth = batchGrowth;
+	checkpoint.batchSeed = batchSeed;
+	double previousSeconds = resumepath != "" ? checkpoint.elapsed : 0;
+	int checkpointedGeneration = firstGeneration;
+	std::chrono::steady_clock::time_point checkpointed = begin;
+	void (*previousTerminate)(int) = SIG_DFL;
+	if (checkpointPath != "") {
+		training_terminate = 0;
+		previousTerminate = signal(SIGTERM, training_terminate_signal);
+	}
+	auto writeCheckpointIfDue = [&](int generation) { // true when training should stop here
+		if (checkpointPath == "" || generation == generations) return false;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		bool due = training_terminate
+			|| (checkpointGenerations > 0 && generation - checkpointedGeneration >= checkpointGenerations)
+			|| (checkpointSeconds > 0 && std::chrono::duration<double>(now - checkpointed).count() >= checkpointSeconds);
+		if (!due) return false;
+		checkpoint.generation = generation;
+		checkpoint.evaluations = run.evaluations;
+		checkpoint.reused = run.reused;
+		checkpoint.aborted = run.aborted;
+		checkpoint.samples = run.samples;
+		checkpoint.offered = run.offered;
+		checkpoint.batchSize = run.batchSize;
+		checkpoint.batchScored = run.batchScored[0]; // islands evolve the same generations on the same batch sizes
+		checkpoint.bestValidated = bestValidated;
+		checkpoint.elapsed = previousSeconds + std::chrono::duration<double>(now - begin).count();
+		if (writeCheckpoint(checkpointPath, checkpoint, islands)) {
+			checkpointedGeneration = generation;
+			checkpointed = now;
+		}
+		return (bool)training_terminate;
+	};
 	
-	// Get weights from best chromosome
-	double currentbestfitness = 0;
-	for (auto it = population.begin(); it != population.end(); ++it) {
-		Chromosome c = *it;
-		if (c.fitness > currentbestfitness) {
-			currentbestfitness = c.fitness;
-			neuralnet.setWeights(c.genes);
+	// With mini-batches, every batchValidation generations the best chromosome of each island is scored on every sample. A
+	// validation that finds nothing better than the last ones means training has converged as far as batches this small
+	// tell apart, so the batch grows by batchGrowth.
+	auto miniBatching = [&]() { return run.batchSize > 0 && run.batchSize < run.count; };
+	auto validate = [&](int generation) {
+		double best = -INFINITY;
+		for (int k = 0; k < islandCount; k++) {
+			Genetic<Scalar> &genalg = islands.getIsland(k);
+			genalg.calculateFitnessMetrics();
+			int done;
+			best = std::max(best, evaluateChromosome(run, 0, Span<const Scalar>(genalg.getGenes(genalg.getBestChromosome())), run.inputs, run.expected, run.count, -INFINITY, done));
 		}
+		std::cout << "OUT: TRAINING: generation " << generation << ", mini-batch of " << run.batchSize << ": best=" << best << " on every sample" << std::endl;
+		if (best <= bestValidated && batchGrowth > 1) run.batchSize = (int)std::min<double>(run.count, ceil(run.batchSize * batchGrowth));
+		bestValidated = std::max(bestValidated, best);
+	};
+	
+	// Iterate generations: one population is scored across every thread, islands evolve a thread each between migrations
+	// unless streaming, when they take turns and each is scored across every thread
+	int generation = firstGeneration;
+	bool stopped = false, unreadable = false;
+	while (generation < generations && !stopped && !unreadable) {
+		int span = islandCount == 1 ? 1 : std::min(interval, generations - generation);
+		if (islandCount > 1 && !streaming) {
+			IslandJob<Scalar> job = { &run, &islands, generation, span, {0} };
+			pool.run(evolveIslandsTask<Scalar>, &job);
+		} else {
+			for (int k = 0; k < islandCount && !unreadable; k++) {
+				for (int g = generation; g < generation + span && !unreadable; g++) unreadable = !evolve(run, islands.getIsland(k), k, g, &pool, 0);
+			}
+			if (unreadable) break; // streaming, the only scoring that reads the data file as it goes, failed
+		}
+		generation += span;
+		if (miniBatching() && batchValidation > 0 && generation / batchValidation > (generation - span) / batchValidation) validate(generation); // with islands, at the first migration after every batchValidation generations
+		if (islandCount > 1 && generation < generations) islands.migrate();
+		stopped = writeCheckpointIfDue(generation); // with islands, only between migrations, where they wait for each other anyway
+	}
+	if (run.batchScored[0] && !stopped) { // the last generation's scores only rank it on its batch, score it on every sample to pick the best
+		for (int k = 0; k < islandCount; k++) {
+			Genetic<Scalar> &genalg = islands.getIsland(k);
+			genalg.invalidateFitness();
+			FitnessJob<Scalar> job = { &run, &genalg, run.inputs, run.expected, run.count, -INFINITY, evaluationBlock(run, genalg.getPopulationSize(), pool.size()), {0} };
+			pool.run(evaluateFitnessTask<Scalar>, &job);
+			run.evaluations += genalg.getPopulationSize();
+			run.offered += (long)genalg.getPopulationSize() * run.count;
+		}
+	}
+	selectActivation(activationName(previousActivation));
+	if (checkpointPath != "") signal(SIGTERM, previousTerminate);
+	if (unreadable) { // the network keeps the weights it had
+		std::cerr << "ERROR: training stopped at generation " << generation << ", the training data could not be read" << std::endl;
+		return;
+	}
+	if (stopped) { // the checkpoint holds the run, let the signal do what it was sent for
+		std::cout << "OUT: TRAINING: stopped at generation " << generation << ", resume with train --resume " << checkpointPath << std::endl;
+		farm.reset();
+		raise(SIGTERM);
+		return;
 	}
-	// std::cout << currentbestfitness;
-	// std::cout << population[genalg->getBestChromosome()].fitness << " " << genalg->getChromosomes()[genalg->getBestChromosome()].fitness;
-	// neuralnet.setWeights(population[genalg->getBestChromosome()].genes);
 	
-	// Print final max and average fitnesses, and elapsed time
-	clock_t end = clock();
-    double elapsedSeconds = (double(end - begin) / CLOCKS_PER_SEC);
-	std::cout << "OUT: TRAINING: best=" << genalg->getBestFitness() << ", avg=" << genalg->getAverageFitness() << ", elapsed=";
-	printf("%.4lf seconds\n", elapsedSeconds);
+	// Get weights from best chromosome of the last generation, over every island
+	int bestIsland = 0;
+	double totalFitness = 0;
+	for (int k = 0; k < islandCount; k++) {
+		Genetic<Scalar> &genalg = islands.getIsland(k);
+		genalg.calculateFitnessMetrics();
+		totalFitness += genalg.getAverageFitness() * genalg.getPopulationSize();
+		if (genalg.getBestFitness() > islands.getIsland(bestIsland).getBestFitness()) bestIsland = k;
+		if (islandCount > 1) std::cout << "OUT: ISLAND " << k << ": best=" << genalg.getBestFitness() << ", avg=" << genalg.getAverageFitness() << std::endl;
+	}
+	Genetic<Scalar> &best = islands.getIsland(bestIsland);
+	neuralnet.setWeights(best.getGenes(best.getBestChromosome()));
 	
-	// Load testing data
-	std::vector<std::pair<std::vector<double>, std::vector<double>>> testingdata;
-	std::ifstream testingfile(testname);
-    while (std::getline(testingfile, line)) {
-        if (line[0] != '#') { // ignore comments
-			if (line.length() > 0) { // ignore blank lines
-				std::vector<std::string> two_parts = string_split(line, ':');
-				std::vector<std::string> inputs_pre = string_split(two_parts[0], ' ');
-				std::vector<std::string> outputs_pre = string_split(two_parts[1], ' ');
-				
-				std::vector<double> inputs;
-				std::vector<double> outputs;
-				for (auto it = inputs_pre.begin(); it != inputs_pre.end(); ++it) {
-					try { inputs.push_back(stof(*it)); } catch (...) { }
-				}
-				for (auto it = outputs_pre.begin(); it != outputs_pre.end(); ++it) {
-					try { outputs.push_back(stof(*it)); } catch (...) { }
-				}
-				
-				if (inputs.size() != inputCount || outputs.size() != outputCount) {
-					std::cerr << "ERROR: Invalid training data file!" << std::endl;
-					break;
-				}
-				
-				testingdata.push_back(std::pair<std::vector<double>, std::vector<double>>(inputs, outputs));
-            }
-        }
-    }
+	// Print final max and average fitnesses, and elapsed time
+    double elapsedSeconds = previousSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	long evaluations = run.evaluations, reused = run.reused;
+	std::cout << "OUT: TRAINING: best=" << best.getBestFitness() << ", avg=" << totalFitness / popsize << ", elapsed=";
+	if (farm) printf("%.4lf seconds on %d workers (%ld restarted)", elapsedSeconds, farm->size(), farm->getRestarts());
+	else printf("%.4lf seconds on %d threads", elapsedSeconds, threads);
+	if (streaming) printf(" streaming %d samples a chunk", stream.getChunkSamples());
+	if (batchSize > 0) printf(" with mini-batches of %d", run.batchSize);
+	printf(", %ld evaluations, %ld reused (%.1lf%%)", evaluations, reused, 100.0 * reused / std::max(1L, evaluations + reused));
+	if (abortElite || abortAt >= 0) printf(", %ld stopped early (%.1lf%% of samples skipped)", run.aborted.load(), 100.0 - 100.0 * run.samples / std::max(1.0, (double)run.offered));
+	printf("\n");
 	
 	// Validate using testing data
+	scoreNetwork(testname, "TESTING");
+}
+
+template <typename Scalar>
+bool NeuralHost<Scalar>::quantizeNetwork(std::string dataname) {
+	Dataset<Scalar> calibration;
+	if (!calibration.load(dataname, neuralnet.getInputs().size(), neuralnet.getOutputs().size())) return false;
+	calibrationInputs.assign(calibration.getInputs().begin(), calibration.getInputs().end()); // kept for the deviation report
+	calibrationCount = calibration.size();
+	if (!quantizednet.quantize(neuralnet, calibrationInputs, calibrationCount)) return false;
+	
+	size_t floatBytes = neuralnet.getNumberOfWeights() * sizeof(Scalar);
+	size_t quantizedBytes = quantizednet.getWeightBytes();
+	std::cout << "OUT: QUANTIZED: calibrated with " << calibrationCount << " samples, weights " << floatBytes << " -> " << quantizedBytes << " bytes (";
+	printf("%.1lfx smaller)\n", (double)floatBytes / quantizedBytes);
+	return true;
+}
+
+template <typename Scalar>
+void NeuralHost<Scalar>::scoreNetwork(std::string dataname, std::string label) {
+	int inputCount = neuralnet.getInputs().size();
+	int outputCount = neuralnet.getOutputs().size();
+	Dataset<Scalar> samples;
+	if (!samples.load(dataname, inputCount, outputCount)) return;
+	int count = samples.size();
+	const Scalar *expected = samples.getOutputs().data();
+	
+	// a batch at a time, so a set larger than memory is scored with bounded buffers as it streams through the page cache
+	std::vector<Scalar> outputs((size_t)std::min(count, STREAM_BATCH_SAMPLES) * outputCount);
 	double deviation = 0;
-	for (auto it = testingdata.begin(); it != testingdata.end(); ++it) {
-		std::pair<std::vector<double>, std::vector<double>> sample = *it;
-		
-		std::vector<double> outputs = neuralnet.propagate(sample.first);
-		
-		double current_sample_fitness = 0;
-		for (int i = 0; i < outputCount; i++) {
-			current_sample_fitness += 1 - fabs(outputs[i] - sample.second[i]); // similar to fitness calculation
+	for (int first = 0; first < count; first += STREAM_BATCH_SAMPLES) {
+		int batch = std::min(STREAM_BATCH_SAMPLES, count - first);
+		neuralnet.propagateBatch(Span<const Scalar>(samples.getInputs().data() + (size_t)first * inputCount, (size_t)batch * inputCount), batch, Span<Scalar>(outputs.data(), (size_t)batch * outputCount));
+		const Scalar *batchExpected = expected + (size_t)first * outputCount;
+		for (int i = 0; i < batch * outputCount; i++) {
+			deviation += (1 - fabs(outputs[i] - batchExpected[i])) / outputCount; // similar to fitness calculation
 		}
-		
-		deviation += current_sample_fitness / outputCount;
 	}
-	std::cout << "OUT: TESTING: " << 100*deviation / testingdata.size() << "% accuracy (higher is better)" << std::endl;
+	std::cout << "OUT: " << label << ": " << 100*deviation / count << "% accuracy (higher is better)" << std::endl;
 	
 	
 	//// THIS IS TESTING CODE THAT SHOWS THE BASIC WORKFLOW FOR TRAINING WITH A GENETIC ALGORITHM
@@ -420,16 +1117,17 @@ void NeuralHost::trainNetwork(std::string trainname, std::string testname, int p
 
 
 
-bool NeuralHost::runCommand(std::string command) {
+template <typename Scalar>
+bool NeuralHost<Scalar>::runCommand(std::string command) {
     if (command == "") return true;
     
     std::string::size_type pos = command.find(' ',0);
-    std::string arguments = (pos != command.length()) ? command.substr(pos+1) : "";
+    std::string arguments = (pos != std::string::npos) ? command.substr(pos+1) : "";
     std::string opcode = command.substr(0,pos);
     
-    std::string firstarg, secondarg, thirdarg, fourtharg;
+    std::string firstarg, secondarg, thirdarg, fourtharg, fiftharg, sixtharg, seventharg;
     std::istringstream args(arguments);
-    args >> firstarg >> secondarg >> thirdarg >> fourtharg;
+    args >> firstarg >> secondarg >> thirdarg >> fourtharg >> fiftharg >> sixtharg >> seventharg;
     
     if (opcode == "print") { // print out a string
         std::cout << "OUT: " << arguments << std::endl;
@@ -439,14 +1137,55 @@ bool NeuralHost::runCommand(std::string command) {
         printStats("OUT: ");
     } else if (opcode == "save") { // persists the neural network to the output files
         saveNetwork();
+    } else if (opcode == "prune") { // zeroes small weights and switches to sparse propagation: "prune magnitude 0.05", "prune fraction 0.5" or "prune off"
+        if (firstarg == "off") {
+            neuralnet.setSparse(false);
+        } else if (firstarg == "magnitude" || firstarg == "fraction") {
+            double amount = std::stod(secondarg);
+            int zeroed = (firstarg == "magnitude") ? neuralnet.prune(amount) : neuralnet.pruneFraction(amount);
+            weightsChanged();
+            int synapses = 0, sparseLayers = 0;
+            for (int i = 0; i < neuralnet.getLayers().size(); i++) {
+                synapses += neuralnet.getLayers()[i].numNeurons * neuralnet.getLayers()[i].numInputsPerNeuron;
+                if (neuralnet.isLayerSparse(i)) sparseLayers++;
+            }
+            std::cout << "OUT: PRUNED: " << zeroed << " of " << synapses << " synapses are zero, " << sparseLayers << " of " << neuralnet.getLayers().size() << " layers evaluated sparse" << std::endl;
+        } else {
+            std::cerr << "Expected prune magnitude <threshold>, prune fraction <fraction> or prune off" << std::endl;
+            return false;
+        }
+    } else if (opcode == "compile") { // writes the network as a C++ header, see "make compiled"
+        return compileNetwork(firstarg);
     } else if (opcode == "reset") { // resets the neural network to a "fresh" configuration
-        neuralnet = NeuralNet();
+        neuralnet = NeuralNet<Scalar>();
+        neuralnet.setThreadPool(threadPool.get(), parallelMinimumWidth);
+        weightsChanged();
     } else if (opcode == "randomize") { // randomizes all the weights in the neural network
         neuralnet.randomizeWeights();
+        weightsChanged();
     } else if (opcode == "zeroweights") { // zeroes all the weights in the neural network
         neuralnet.zeroWeights();
+        weightsChanged();
     } else if (opcode == "learn" || opcode == "train") { // trains the neural network
-		trainNetwork(firstarg, secondarg, stoi(thirdarg), stoi(fourtharg));
+		Crossover trainingCrossover = crossover;
+		if (firstarg == "--resume") { // continue from a checkpoint, with this process's threads or workers
+			std::string path = secondarg != "" ? secondarg : checkpointPath;
+			trainNetwork("", "", 0, 0, thirdarg != "" ? stoi(thirdarg) : trainingThreads, trainingCrossover, islandCount, path);
+			weightsChanged();
+			return true;
+		}
+		if (sixtharg != "" && !crossoverFromName(sixtharg, trainingCrossover)) {
+			std::cerr << "Unknown crossover \"" << sixtharg << "\", expected single, two, uniform, arithmetic, blend or neuron" << std::endl;
+			return false;
+		}
+		trainNetwork(firstarg, secondarg, stoi(thirdarg), stoi(fourtharg), fiftharg != "" ? stoi(fiftharg) : trainingThreads, trainingCrossover, seventharg != "" ? stoi(seventharg) : islandCount);
+		weightsChanged(); // quantize again to keep using int8
+ 	} else if (opcode == "score") { // evaluates the neural network against a data file
+		scoreNetwork(firstarg, "SCORE");
+ 	} else if (opcode == "convert") { // writes a text data file as a binary one training maps instead of parsing: "convert data.txt data.bin"
+		Dataset<Scalar> samples;
+		if (!samples.load(firstarg, neuralnet.getInputs().size(), neuralnet.getOutputs().size()) || !samples.save(secondarg)) return false;
+		std::cout << "OUT: converted " << samples.size() << " samples to " << secondarg << std::endl;
  	} else if (opcode == "inputadd") { // add an input to the neural network
         neuralnet.addInput(firstarg);
     } else if (opcode == "outputadd") { // add an output neuron to the neural network
@@ -463,8 +1202,138 @@ bool NeuralHost::runCommand(std::string command) {
         neuralnet.addLayer(std::stoi(firstarg), std::stoi(secondarg));
     } else if (opcode == "layerremove") {
         neuralnet.removeLayer(std::stoi(firstarg));
+    } else if (opcode == "quantize") { // switch update() to int8 inference calibrated with a data file, or back with "off"
+        if (firstarg == "off") {
+            quantizednet.clear();
+        } else if (!quantizeNetwork(firstarg)) {
+            return false;
+        }
+    } else if (opcode == "threads") { // show or set the threads wide layers are split across and the narrowest layer split: "threads 4 512", "threads 1" is single threaded
+        if (firstarg != "") {
+            int threads = std::stoi(firstarg);
+            if (threads < 1) {
+                std::cerr << "Expected threads <count> [minimum layer width]" << std::endl;
+                return false;
+            }
+            if (secondarg != "") parallelMinimumWidth = std::stoi(secondarg);
+            neuralnet.setThreadPool(NULL, parallelMinimumWidth); // the old pool goes away first
+            threadPool.reset(threads > 1 ? new ThreadPool(threads, true) : NULL);
+            neuralnet.setThreadPool(threadPool.get(), parallelMinimumWidth);
+        }
+        std::cout << "OUT: threads: " << (threadPool ? threadPool->size() : 1) << " (" << ThreadPool::hardwareThreads() << " CPUs), layers of at least " << parallelMinimumWidth << " neurons are split" << std::endl;
+    } else if (opcode == "trainthreads") { // show or set the threads evaluating fitness during training
+        if (firstarg != "") {
+            if (std::stoi(firstarg) < 1) {
+                std::cerr << "Expected trainthreads <count>" << std::endl;
+                return false;
+            }
+            trainingThreads = std::stoi(firstarg);
+        }
+        std::cout << "OUT: training threads: " << trainingThreads << " (" << ThreadPool::hardwareThreads() << " CPUs)" << std::endl;
+    } else if (opcode == "selection") { // show or set how training picks parents: roulette, alias, universal, "tournament k" or "truncation k"
+        if (firstarg != "") {
+            Selection previous = selection;
+            if (!selectionFromName(firstarg, selection)) {
+                std::cerr << "Unknown selection \"" << firstarg << "\", expected roulette, alias, universal, tournament or truncation" << std::endl;
+                return false;
+            }
+            if (secondarg != "") selectionSize = std::max(1, std::stoi(secondarg));
+            else if (selection != previous) selectionSize = selection == SelectionTruncation ? TRUNCATION_SIZE : 2;
+        }
+        std::cout << "OUT: selection: " << selectionName(selection);
+        if (selection == SelectionTournament || selection == SelectionTruncation) std::cout << " of " << selectionSize;
+        std::cout << std::endl;
+    } else if (opcode == "crossover") { // show or set how training mixes parents: single, two, uniform, arithmetic, neuron or "blend alpha"
+        if (firstarg != "") {
+            if (!crossoverFromName(firstarg, crossover)) {
+                std::cerr << "Unknown crossover \"" << firstarg << "\", expected single, two, uniform, arithmetic, blend or neuron" << std::endl;
+                return false;
+            }
+            if (secondarg != "") blendAlpha = std::stod(secondarg);
+        }
+        std::cout << "OUT: crossover: " << crossoverName(crossover);
+        if (crossover == CrossoverBlend) std::cout << " alpha " << blendAlpha;
+        std::cout << std::endl;
+    } else if (opcode == "checkpoint") { // show or set where and how often training writes checkpoints: "checkpoint path 50 600" or "checkpoint off"
+        if (firstarg == "off") {
+            checkpointPath = "";
+        } else if (firstarg != "") {
+            checkpointPath = firstarg;
+            if (secondarg != "") checkpointGenerations = std::max(0, std::stoi(secondarg));
+            if (thirdarg != "") checkpointSeconds = std::max(0.0, std::stod(thirdarg));
+        }
+        if (checkpointPath == "") std::cout << "OUT: checkpoints: off" << std::endl;
+        else std::cout << "OUT: checkpoints: " << checkpointPath << " every " << checkpointGenerations << " generations or " << checkpointSeconds << " seconds" << std::endl;
+    } else if (opcode == "minibatch") { // show or set the samples each generation is scored on, how the batch grows and how often it is validated: "minibatch 256 2 10", or off
+        if (firstarg == "off") miniBatchSize = 0;
+        else if (firstarg != "") miniBatchSize = std::max(0, std::stoi(firstarg));
+        if (secondarg != "") miniBatchGrowth = std::max(1.0, std::stod(secondarg));
+        if (thirdarg != "") miniBatchValidation = std::max(0, std::stoi(thirdarg));
+        if (miniBatchSize == 0) std::cout << "OUT: mini-batches: off" << std::endl;
+        else std::cout << "OUT: mini-batches: " << miniBatchSize << " samples, growing " << miniBatchGrowth << "x when a validation every " << miniBatchValidation << " generations does not improve" << std::endl;
+    } else if (opcode == "stream") { // show or set the megabytes of training samples kept in memory when streaming them from a binary data file, or off
+        if (firstarg == "off") streamBudget = 0;
+        else if (firstarg != "") streamBudget = (size_t)(std::max(0.0, std::stod(firstarg)) * 1024 * 1024);
+        if (streamBudget == 0) std::cout << "OUT: streaming: off" << std::endl;
+        else std::cout << "OUT: streaming: " << streamBudget / (1024.0 * 1024.0) << " MB of samples in memory" << std::endl;
+    } else if (opcode == "workers") { // show or set how many worker processes training scores chromosomes in, 0 for threads in this process
+        if (firstarg != "") trainingWorkers = std::max(0, std::stoi(firstarg));
+        std::cout << "OUT: training workers: " << trainingWorkers << std::endl;
+    } else if (opcode == "islands") { // show or set how many populations training evolves apart, and how they migrate: "islands 4 10 2 ring"
+        if (firstarg != "") islandCount = std::max(1, std::stoi(firstarg));
+        if (secondarg != "") migrationInterval = std::max(1, std::stoi(secondarg));
+        if (thirdarg != "") migrants = std::max(0, std::stoi(thirdarg));
+        if (fourtharg != "" && !migrationFromName(fourtharg, migration)) {
+            std::cerr << "Unknown migration \"" << fourtharg << "\", expected ring or random" << std::endl;
+            return false;
+        }
+        std::cout << "OUT: islands: " << islandCount << ", migrating " << migrants << " every " << migrationInterval << " generations, " << migrationName(migration) << std::endl;
+    } else if (opcode == "earlyabort") { // show or set when training stops evaluating a chromosome: off, elite, or a percentile of the previous generation
+        if (firstarg == "off") {
+            abortBelowElite = false;
+            abortPercentile = -1;
+        } else if (firstarg == "elite") {
+            abortBelowElite = true;
+            abortPercentile = -1;
+        } else if (firstarg != "") {
+            abortBelowElite = false;
+            abortPercentile = std::stod(firstarg);
+            if (abortPercentile < 0 || abortPercentile > 100) {
+                std::cerr << "Expected earlyabort off, elite or a percentile from 0 to 100" << std::endl;
+                abortPercentile = -1;
+                return false;
+            }
+        }
+        std::cout << "OUT: early abort: ";
+        if (abortBelowElite) std::cout << "below the elite" << std::endl;
+        else if (abortPercentile >= 0) std::cout << "below percentile " << abortPercentile << " of the previous generation" << std::endl;
+        else std::cout << "off" << std::endl;
+    } else if (opcode == "seed") { // show or set the random seed, the same seed and commands train the same network
+        if (firstarg != "") seedRandom(std::stoull(firstarg));
+        std::cout << "OUT: seed: " << randomSeed() << std::endl;
     } else if (opcode == "timepropagation") {
         timePropagation();
+    } else if (opcode == "kernels") { // show or pick the instruction set used for propagation
+        if (firstarg != "" && !selectKernels(firstarg)) {
+            std::cerr << "Kernels \"" << firstarg << "\" are not supported on this CPU" << std::endl;
+            return false;
+        }
+        std::cout << "OUT: kernels: " << kernels<Scalar>().name << " (available:";
+        for (std::string name : availableKernels()) std::cout << " " << name;
+        std::cout << ")" << std::endl;
+    } else if (opcode == "activation") { // show or pick how the sigmoid is evaluated, "activation name train" only affects training
+        if (firstarg != "") {
+            Activation previous = activation();
+            if (!selectActivation(firstarg)) {
+                std::cerr << "Unknown activation \"" << firstarg << "\", expected exact, table or poly" << std::endl;
+                return false;
+            }
+            if (secondarg == "train") { // keep the current one outside training
+                trainingActivation = firstarg;
+                selectActivation(activationName(previous));
+            }
+        }
+        std::cout << "OUT: activation: " << activationName(activation()) << " (max error " << activationMaxError(activation()) << "), training: " << (trainingActivation != "" ? trainingActivation : "same") << std::endl;
     } else if (opcode == "addinputmapping") {
         addInputMapping(firstarg, secondarg, thirdarg);
     } else if (opcode == "setoutputfile") {
@@ -483,29 +1352,124 @@ bool NeuralHost::runCommand(std::string command) {
     return true;
 }
 
-void NeuralHost::addInputMapping(std::string outputfilename, std::string outputname, std::string inputname) {
+template <typename Scalar>
+void NeuralHost<Scalar>::weightsChanged() {
+    quantizednet.clear();
+    compiledVersion = -1;
+}
+
+template <typename Scalar>
+void NeuralHost<Scalar>::addInputMapping(std::string outputfilename, std::string outputname, std::string inputname) {
     inputMappings[outputfilename][outputname] = inputname;
+    resolvedVersion = -1; // resolve again on the next update
 }
 
-void NeuralHost::timePropagation() {
+template <typename Scalar>
+void NeuralHost<Scalar>::timePropagation() {
     static const int iterations = 100;
-    int numInputs = neuralnet.getInputs().size();
+    std::vector<Scalar> inputs(neuralnet.getInputs().size());
+    std::vector<Scalar> outputs(neuralnet.getOutputs().size());
+    neuralnet.propagate(inputs, outputs); // warm up
+    size_t allocationsBefore = allocationCount();
     clock_t begin = clock();
     for (int i = 0; i < iterations; i++) {
-        std::vector<double> inputs;
-        for (int j = 0; j < numInputs; j++) {
-            inputs.push_back(randomClamped());
+        for (int j = 0; j < inputs.size(); j++) {
+            inputs[j] = randomClamped();
         }
-        neuralnet.propagate(inputs);
+        neuralnet.propagate(inputs, outputs);
     }
     clock_t end = clock();
+    size_t allocations = allocationCount() - allocationsBefore;
     double elapsedSeconds = (double(end - begin) / CLOCKS_PER_SEC) / iterations;
-    std::cout << "OUT: " << "Neural network propagation time: ";
-    printf("%.4lf seconds / %.4lf milliseconds", elapsedSeconds, elapsedSeconds*1000);
+    std::cout << "OUT: " << "Neural network propagation time (" << kernels<Scalar>().name << ", " << activationName(activation()) << " activation" << (neuralnet.isSparse() ? ", sparse" : "") << "): ";
+    printf("%.4lf seconds / %.4lf milliseconds, %.2lf allocations per propagation", elapsedSeconds, elapsedSeconds*1000, (double)allocations / iterations);
+    std::cout << std::endl;
+    
+    // wall clock time across thread counts, clock() would add up every thread's time
+    int widest = 0;
+    for (const NeuronLayer &layer : neuralnet.getLayers()) widest = std::max(widest, layer.numNeurons);
+    if (widest >= parallelMinimumWidth) {
+        std::vector<int> counts;
+        for (int threads = 1; threads < ThreadPool::hardwareThreads(); threads *= 2) counts.push_back(threads);
+        counts.push_back(ThreadPool::hardwareThreads());
+        if (threadPool && std::find(counts.begin(), counts.end(), threadPool->size()) == counts.end()) counts.push_back(threadPool->size());
+        
+        double singleSeconds = 0;
+        std::cout << "OUT: " << "Threaded propagation time (layers of at least " << parallelMinimumWidth << " neurons split):";
+        for (int threads : counts) {
+            ThreadPool pool(threads, true);
+            neuralnet.setThreadPool(&pool, parallelMinimumWidth);
+            neuralnet.propagate(inputs, outputs); // warm up
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++) neuralnet.propagate(inputs, outputs);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+            if (threads == 1) singleSeconds = seconds;
+            printf(" %d: %.4lf ms (%.2lfx)", threads, seconds*1000, singleSeconds / seconds);
+        }
+        std::cout << std::endl;
+        neuralnet.setThreadPool(threadPool.get(), parallelMinimumWidth);
+    }
+    
+    if (compiledVersion == neuralnet.getStructureVersion()) { // same inputs through the linked compiled network
+        begin = clock();
+        for (int i = 0; i < iterations; i++) {
+            for (int j = 0; j < inputs.size(); j++) {
+                inputs[j] = randomClamped();
+            }
+            propagateCompiled(inputs, outputs);
+        }
+        end = clock();
+        double compiledSeconds = (double(end - begin) / CLOCKS_PER_SEC) / iterations;
+        std::cout << "OUT: " << "Compiled network propagation time: ";
+        printf("%.4lf seconds / %.4lf milliseconds, %.2lfx speedup", compiledSeconds, compiledSeconds*1000, elapsedSeconds / compiledSeconds);
+        std::cout << std::endl;
+    }
+    
+    if (quantizednet.empty()) return;
+    if (quantizednet.isStaleFor(neuralnet)) {
+        std::cerr << "Network structure changed since quantizing, skipping the quantized timing" << std::endl;
+        return;
+    }
+    
+    // same inputs through the quantized network
+    std::vector<Scalar> quantizedOutputs(outputs.size());
+    quantizednet.propagate(inputs, quantizedOutputs); // warm up
+    allocationsBefore = allocationCount();
+    begin = clock();
+    for (int i = 0; i < iterations; i++) {
+        for (int j = 0; j < inputs.size(); j++) {
+            inputs[j] = randomClamped();
+        }
+        quantizednet.propagate(inputs, quantizedOutputs);
+    }
+    end = clock();
+    allocations = allocationCount() - allocationsBefore;
+    double quantizedSeconds = (double(end - begin) / CLOCKS_PER_SEC) / iterations;
+    std::cout << "OUT: " << "Quantized int8 propagation time (" << kernels<Scalar>().name << "): ";
+    printf("%.4lf seconds / %.4lf milliseconds, %.2lf allocations per propagation, %.2lfx speedup", quantizedSeconds, quantizedSeconds*1000, (double)allocations / iterations, elapsedSeconds / quantizedSeconds);
+    std::cout << std::endl;
+    
+    // accuracy against the float network over the calibration samples
+    int inputCount = neuralnet.getInputs().size();
+    double meanDeviation = 0, maxDeviation = 0;
+    for (int i = 0; i < calibrationCount; i++) {
+        Span<const Scalar> sample(calibrationInputs.data() + (size_t)i * inputCount, inputCount);
+        neuralnet.propagate(sample, outputs);
+        quantizednet.propagate(sample, quantizedOutputs);
+        for (int j = 0; j < outputs.size(); j++) {
+            double deviation = fabs(outputs[j] - quantizedOutputs[j]);
+            meanDeviation += deviation;
+            maxDeviation = std::max(maxDeviation, deviation);
+        }
+    }
+    if (calibrationCount > 0 && !outputs.empty()) meanDeviation /= (double)calibrationCount * outputs.size();
+    std::cout << "OUT: " << "Quantized output deviation over " << calibrationCount << " calibration samples: ";
+    printf("mean %.6lf, max %.6lf", meanDeviation, maxDeviation);
     std::cout << std::endl;
 }
 
-void NeuralHost::saveNetwork() {
+template <typename Scalar>
+void NeuralHost<Scalar>::saveNetwork() {
     // save structure
     std::ofstream structurefile(structurepath);
     for (std::string input : neuralnet.getInputs())
@@ -514,23 +1478,133 @@ void NeuralHost::saveNetwork() {
     for (std::string output : neuralnet.getOutputs())
         structurefile << output << " ";
     structurefile << std::endl;
-    for (NeuronLayer layer : neuralnet.getLayers())
-        structurefile << layer.numNeurons << " " << layer.numInputsPerNeuron << std::endl;
+    for (int i = 0; i < neuralnet.getLayers().size(); i++) { // pruned layers evaluated sparse are flagged, their zeros are in the weights file
+        const NeuronLayer &layer = neuralnet.getLayers()[i];
+        structurefile << layer.numNeurons << " " << layer.numInputsPerNeuron << (neuralnet.isLayerSparse(i) ? " sparse" : "") << std::endl;
+    }
     structurefile.close();
     
     // save weights
     std::ofstream weightsfile(weightspath);
-    for (double w : neuralnet.getWeights()) weightsfile << w << " ";
+    weightsfile << std::setprecision(std::numeric_limits<Scalar>::max_digits10); // enough digits to read back the same weights
+    for (Scalar w : neuralnet.getWeightsByNeuron()) weightsfile << w << " ";
     weightsfile.close();
     
     std::cout << "OUT: " << "Neural network succesfully saved" << std::endl;
 }
 
+/// a C++ string literal for name
+static std::string quoted(const std::string &name) {
+    std::string literal = "\"";
+    for (char c : name) {
+        if (c == '"' || c == '\\') literal += '\\';
+        literal += c;
+    }
+    return literal + "\"";
+}
+
+/// a C++ floating point literal that reads back as exactly value
+template <typename Scalar>
+static std::string literal(Scalar value) {
+    char text[64];
+    snprintf(text, sizeof(text), "%.*g", std::numeric_limits<Scalar>::max_digits10, (double)value);
+    std::string number = text;
+    if (number.find_first_of(".e") == std::string::npos) number += ".0";
+    return sizeof(Scalar) == sizeof(float) ? number + "f" : number;
+}
 
-void NeuralHost::readStructureFile() {
+template <typename Scalar>
+bool NeuralHost<Scalar>::compileNetwork(std::string path) {
+    const std::vector<NeuronLayer> &layers = neuralnet.getLayers();
+    if (path == "" || neuralnet.getInputs().empty() || neuralnet.getOutputs().empty()) {
+        std::cerr << "Only a network with inputs and outputs can be compiled, to a header path" << std::endl;
+        return false;
+    }
+    for (const NeuronLayer &layer : layers) {
+        if (layer.numNeurons == 0) {
+            std::cerr << "Remove the empty hidden layers before compiling" << std::endl;
+            return false;
+        }
+    }
+    
+    std::ofstream header(path);
+    if (!header) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+    bool isFloat = sizeof(Scalar) == sizeof(float);
+    
+    header << "// Generated by the feedforward compile command from " << (structurepath ? structurepath : "a new network") << " and " << (weightspath ? weightspath : "its weights") << ", do not edit." << std::endl;
+    header << "// Build it in with: make compiled NETWORK=" << path << std::endl << std::endl;
+    header << "#pragma once" << std::endl << std::endl;
+    header << "#include \"compiled.h\"" << std::endl << std::endl;
+    header << "namespace compiled_network {" << std::endl << std::endl;
+    header << "typedef " << (isFloat ? "float" : "double") << " Scalar;" << std::endl;
+    header << "static constexpr int numInputs = " << neuralnet.getInputs().size() << ";" << std::endl;
+    header << "static constexpr int numOutputs = " << neuralnet.getOutputs().size() << ";" << std::endl;
+    header << "static constexpr Scalar biasCoefficient = " << literal(NeuralNet<Scalar>::biasCoefficient) << ";" << std::endl;
+    header << "static constexpr Scalar activationResponse = " << literal(NeuralNet<Scalar>::activationResponse) << ";" << std::endl;
+    header << "static const char *const inputNames[numInputs] = {";
+    for (int i = 0; i < neuralnet.getInputs().size(); i++) header << (i ? ", " : " ") << quoted(neuralnet.getInputs()[i]);
+    header << " };" << std::endl;
+    header << "static const char *const outputNames[numOutputs] = {";
+    for (int i = 0; i < neuralnet.getOutputs().size(); i++) header << (i ? ", " : " ") << quoted(neuralnet.getOutputs()[i]);
+    header << " };" << std::endl;
+    
+    // weights, transposed to one row per input (see compiled.h)
+    const NeuralNet<Scalar> &network = neuralnet;
+    Span<const Scalar> parameters = network.getWeights();
+    for (int i = 0; i < layers.size(); i++) {
+        const NeuronLayer &layer = layers[i];
+        header << std::endl << "alignas(64) static const Scalar weights" << i << "[" << layer.numInputsPerNeuron << "][" << layer.numNeurons << "] = {" << std::endl;
+        for (int k = 0; k < layer.numInputsPerNeuron; k++) {
+            header << "    {";
+            for (int j = 0; j < layer.numNeurons; j++) header << (j ? ", " : " ") << literal(parameters[layer.offset + (size_t)j * layer.numInputsPerNeuron + k]);
+            header << " }," << std::endl;
+        }
+        header << "};" << std::endl;
+        header << "alignas(64) static const Scalar biases" << i << "[" << layer.numNeurons << "] = {";
+        for (int j = 0; j < layer.numNeurons; j++) header << (j ? ", " : " ") << literal(parameters[layer.biasOffset() + j]);
+        header << " };" << std::endl;
+    }
+    
+    // the shape, so feedforward can check the network it loaded is this one
+    header << std::endl << "static constexpr int numLayers = " << layers.size() << ";" << std::endl;
+    header << "static const int layerNeurons[numLayers] = {";
+    for (int i = 0; i < layers.size(); i++) header << (i ? ", " : " ") << layers[i].numNeurons;
+    header << " };" << std::endl << "static const int layerInputs[numLayers] = {";
+    for (int i = 0; i < layers.size(); i++) header << (i ? ", " : " ") << layers[i].numInputsPerNeuron;
+    header << " };" << std::endl << "static const Scalar *const layerWeights[numLayers] = {";
+    for (int i = 0; i < layers.size(); i++) header << (i ? ", " : " ") << "&weights" << i << "[0][0]";
+    header << " };" << std::endl << "static const Scalar *const layerBiases[numLayers] = {";
+    for (int i = 0; i < layers.size(); i++) header << (i ? ", " : " ") << "biases" << i;
+    header << " };" << std::endl;
+    
+    // the forward pass, every size fixed
+    header << std::endl << "/// propagates numInputs inputs into numOutputs outputs" << std::endl;
+    header << "inline void propagate(const Scalar *inputs, Scalar *outputs) {" << std::endl;
+    for (int i = 0; i + 1 < layers.size(); i++) header << "    alignas(64) Scalar activations" << i << "[" << layers[i].numNeurons << "];" << std::endl;
+    for (int i = 0; i < layers.size(); i++) {
+        std::string in = i == 0 ? "inputs" : "activations" + std::to_string(i - 1);
+        std::string out = i + 1 == layers.size() ? "outputs" : "activations" + std::to_string(i);
+        header << "    compiled::Layer<Scalar, " << layers[i].numNeurons << ", " << layers[i].numInputsPerNeuron << ">::apply(weights" << i << ", biases" << i << ", " << in << ", " << out << ", biasCoefficient, activationResponse);" << std::endl;
+    }
+    header << "}" << std::endl << std::endl;
+    header << "} // namespace compiled_network" << std::endl;
+    header.close();
+    
+    std::cout << "OUT: " << "Neural network compiled to " << path << std::endl;
+    return true;
+}
+
+
+template <typename Scalar>
+void NeuralHost<Scalar>::readStructureFile() {
     std::ifstream filestream(structurepath);
     std::string line;
     int linenum = 0;
+    std::vector<std::pair<int, int>> layerShapes; // (neurons, inputs per neuron) for each layer line
+    bool sparse = false; // a pruned network, sparse layers are picked again once the weights are read
     while (std::getline(filestream, line)) {
         std::istringstream iss(line);
         if (linenum == 0) { // inputs
@@ -545,10 +1619,12 @@ void NeuralHost::readStructureFile() {
             }
         } else { // layers
             int numNeurons, numInputsPerNeuron;
+            std::string flag;
             if (!(iss >> numNeurons >> numInputsPerNeuron)) {
                 std::cerr << "ERROR: Malformed structure file!";
             } else {
-                neuralnet.addLayerBeforeOutputLayer(numNeurons, numInputsPerNeuron);
+                layerShapes.push_back(std::pair<int, int>(numNeurons, numInputsPerNeuron));
+                if (iss >> flag && flag == "sparse") sparse = true;
             }
         }
         linenum++;
@@ -556,11 +1632,21 @@ void NeuralHost::readStructureFile() {
     if (linenum < 3) {
         std::cerr << "ERROR: Malformed structure file!";
     }
+    
+    // the last layer line is the output layer, which the outputs above already created
+    for (int i = 0; i + 1 < (int)layerShapes.size(); i++) {
+        neuralnet.addLayerBeforeOutputLayer(layerShapes[i].first, layerShapes[i].second);
+    }
+    if (!layerShapes.empty() && (layerShapes.back().first != neuralnet.getLayers().back().numNeurons || layerShapes.back().second != neuralnet.getLayers().back().numInputsPerNeuron)) {
+        std::cerr << "ERROR: Structure file output layer does not match its outputs!" << std::endl;
+    }
+    neuralnet.setSparse(sparse);
 }
 
-void NeuralHost::readWeightsFile() {
+template <typename Scalar>
+void NeuralHost<Scalar>::readWeightsFile() {
     std::ifstream filestream(weightspath);
-    std::vector<double> loadedWeights;
+    std::vector<Scalar> loadedWeights;
     
     double weight;
     while (filestream >> weight) loadedWeights.push_back(weight);
@@ -569,6 +1655,10 @@ void NeuralHost::readWeightsFile() {
     if (expectedNum != loadedWeights.size()) {
         std::cerr << "ERROR: Could not load weights file! Expected " << expectedNum << ", received " << loadedWeights.size() << " weights." << std::endl;
     } else {
-        neuralnet.setWeights(loadedWeights);
+        neuralnet.setWeightsByNeuron(loadedWeights);
     }
-}
\ No newline at end of file
+}
+
+
+template class NeuralHost<float>;
+template class NeuralHost<double>;
@@ -10,20 +10,65 @@
 #include <sstream>
 #include <ctime>
 #include <map>
+#include <memory>
+#include <chrono>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <ctype.h>
 
 #include "neuralnet.h"
 #include "genetic.h"
+#include "quantized.h"
+#include "kernels.h"
+#include "allocations.h"
+#include "threadpool.h"
+#include "farm.h"
+#include "dataset.h"
 #include "utils.h"
 
 #define TMP_DIR std::string("/tmp/emergence-neuralnet/") ///< tmp directory for XPC
+#define EARLY_ABORT_SAMPLES 32 ///< training samples evaluated between checks whether a chromosome can still reach the cutoff
+#define EVALUATION_BLOCK 8 ///< chromosomes a training thread scores side by side, each tile of samples is read once for all of them
+#define EVALUATION_BLOCK_BYTES (16 * 1024 * 1024) ///< a block's weights, and apart from them its activations, are kept under this: large networks get smaller blocks and tiles
+#define STREAM_BATCH_SAMPLES 1024 ///< samples propagated at once when streaming training data and when scoring, so activation buffers stay small
+#define TRUNCATION_SIZE 10 ///< default fittest chromosomes SelectionTruncation picks parents from
+#define PARALLEL_MIN_WIDTH 512 ///< default narrowest layer the threads command splits across threads, below it the per layer hand off costs more than it saves
 
 /// NeuralHost manages the multi-layer perceptron (NeuralNet instance), this is the main class. Only one instance of this should be running within the program.
+/// Scalar (float or double) is the network's number type, picked when the network is loaded.
+template <typename Scalar>
 class NeuralHost {
-    NeuralNet neuralnet;
+    NeuralNet<Scalar> neuralnet;
+    QuantizedNet<Scalar> quantizednet; ///< int8 copy of neuralnet used by update() when not empty, see quantizeNetwork()
+    std::vector<Scalar> calibrationInputs; ///< the samples quantizednet was calibrated with, row-major
+    int calibrationCount;
+    std::string trainingActivation; ///< the Activation used while evaluating fitness during training, empty to keep the current one
+    int compiledVersion; ///< the structure version the linked compiled network (see COMPILED_NETWORK) was checked against, -1 when it is not in use
+    std::unique_ptr<ThreadPool> threadPool; ///< shared by neuralnet's wide layers, NULL while propagation is single threaded
+    int parallelMinimumWidth;
+    int trainingThreads; ///< threads evaluating fitness during training, each with its own copy of the network
+    int trainingWorkers; ///< processes evaluating fitness during training in place of the threads, see WorkerFarm, 0 for none
+    Selection selection; ///< how training picks parents
+    int selectionSize; ///< chromosomes per tournament with SelectionTournament, the fittest picked from with SelectionTruncation
+    Crossover crossover; ///< how training mixes parents
+    double blendAlpha; ///< how far CrossoverBlend reaches past the parents
+    bool abortBelowElite; ///< stop evaluating chromosomes that cannot make the elite
+    double abortPercentile; ///< stop evaluating chromosomes that cannot reach this percentile of the previous generation, negative for never
+    int islandCount; ///< populations training evolves apart, 1 for a single population
+    int migrationInterval; ///< generations between migrations
+    int migrants; ///< chromosomes each island sends per migration
+    Migration migration;
+    std::string checkpointPath; ///< where training writes checkpoints, empty for none
+    int checkpointGenerations; ///< generations between checkpoints, 0 to go by time only
+    double checkpointSeconds; ///< seconds between checkpoints, 0 to go by generations only
+    size_t streamBudget; ///< bytes of training samples held in memory when streaming them from a binary data file, 0 to load them all
+    int miniBatchSize; ///< training samples each generation is scored on, drawn anew every generation, 0 for every sample
+    double miniBatchGrowth; ///< factor the mini-batch grows by when a validation finds no improvement, 1 to keep its size
+    int miniBatchValidation; ///< generations between scoring the best chromosomes on every sample, 0 for never
     
     char *structurepath;
     char *weightspath;
@@ -31,19 +76,35 @@ class NeuralHost {
     std::map<std::string, std::map<std::string, std::string>> inputMappings;
     std::string outputFile;
     
+    /// an XPC file's outputs resolved to the neural net's input indices, so update() does no lookups
+    struct ResolvedInputFile {
+        std::string path;
+        std::vector<std::pair<std::string, int>> outputs; ///< (output name in the file, input index)
+    };
+    std::vector<ResolvedInputFile> resolvedMappings;
+    int resolvedVersion; ///< the network structure version resolvedMappings and the buffers below were built for
+    std::vector<Scalar> updateInputs, updateOutputs; ///< update()'s input and output vectors, kept between ticks
+    std::vector<char> inputText, outputText; ///< update()'s file buffers, kept between ticks
+    
     void readStructureFile(); ///< read in the structure from an existing file that is accessible
     void readWeightsFile(); ///< read in the weights from an existing file that is accessible, must be called AFTER readStructureFile()
+    void weightsChanged(); ///< drops the quantized and compiled copies of the network, which no longer match its weights
     
-	void trainNetwork(std::string trainname, std::string testname, int popsize, int generations);
+	void trainNetwork(std::string trainname, std::string testname, int popsize, int generations, int threads, Crossover crossover, int islands, std::string resumepath = ""); ///< with a resumepath, continues the run that wrote that checkpoint instead, ignoring the other settings but threads
+
+	void scoreNetwork(std::string dataname, std::string label); ///< runs every sample of a data file through the network and prints the accuracy
+    bool quantizeNetwork(std::string dataname); ///< builds quantizednet, calibrated with the inputs of a data file
 
     void addInputMapping(std::string outputfilename, std::string outputname, std::string inputname); ///< maps an output from an XPC file to an input
+    void resolveInputMappings(); ///< resolves inputMappings against the current structure and sizes the update() buffers
     
     void runAsChildInterruptHandler();
     void runCoordinatorCommand();
-    void update();
 public:
     NeuralHost(char *structurepath, char *weightspath);
     
+    void update(); ///< one tick: reads the mapped input files, propagates and writes the output file, without allocating once warmed up
+    
     void runWithREPL();
     void runAsChild();
     
@@ -55,4 +116,5 @@ public:
     void timePropagation();
     
     void saveNetwork(); ///< saves the network structure and weights to structurepath and weightspath, respectively
+    bool compileNetwork(std::string path); ///< writes the network as a C++ header with its weights baked in, see compiled.h
 };
\ No newline at end of file
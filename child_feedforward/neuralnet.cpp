@@ -3,131 +3,174 @@
 ///////////////////////////////////////////////////////////////
 
 #include "neuralnet.h"
+#include "kernels.h"
 #include "utils.h"
+#include "threadpool.h"
 
 
 /////////////////////////
-// Neuron
-
-Neuron::Neuron(int numberInputs) {
-    numInputs = numberInputs + 1; // +1 for an additional weight for the bias
-
-	for (int i = 0; i < numInputs; i++) {
-		// set up the weights with an initial random value
-		weights.push_back(randomClamped());
-	}
-}
+// Neural Network
 
-void Neuron::addInput() {
-    numInputs++;
-    weights.insert(weights.end() - 1, randomClamped()); // insert before the bias weight
-}
+template <typename Scalar>
+const Scalar NeuralNet<Scalar>::activationResponse = 1;
+template <typename Scalar>
+const Scalar NeuralNet<Scalar>::biasCoefficient = -1;
 
-void Neuron::removeInput(int index) {
-    numInputs--;
-    weights.erase(weights.begin() + index);
-}
+static int lastStructureVersion = 0; ///< shared by every network, so a version never repeats even across a reset
 
-void Neuron::removeInput() {
-    numInputs--;
-    weights.erase(weights.end() - 2);
+template <typename Scalar>
+NeuralNet<Scalar>::NeuralNet() {
+    numInputs = 0;
+    numOutputs = 0;
+    structureVersion = ++lastStructureVersion;
+    sparse = false;
+    threadPool = NULL;
+    parallelMinimumWidth = 0;
+    
+    // create empty output layer
+    layers.push_back(NeuronLayer(0, 0));
 }
 
-/////////////////////////
-// Neuron Layer
-
-NeuronLayer::NeuronLayer(int numberNeurons, int numberInputsPerNeuron) {
-    numNeurons = numberNeurons;
-    numInputsPerNeuron = numberInputsPerNeuron;
-    for (int i = 0; i < numNeurons; i++) {
-        neurons.push_back(Neuron(numberInputsPerNeuron));
+template <typename Scalar>
+const std::vector<std::string> &NeuralNet<Scalar>::getInputs() const { return inputs; }
+template <typename Scalar>
+const std::vector<std::string> &NeuralNet<Scalar>::getOutputs() const { return outputs; }
+template <typename Scalar>
+const std::vector<NeuronLayer> &NeuralNet<Scalar>::getLayers() const { return layers; }
+
+template <typename Scalar>
+void NeuralNet<Scalar>::rebuild(std::vector<NeuronLayer> newLayers, std::function<Scalar(int, int, int)> source) {
+    size_t size = 0;
+    for (int i = 0; i < newLayers.size(); i++) { // assign each layer its slice of the new buffer
+        newLayers[i].offset = size;
+        size += newLayers[i].getNumberOfWeights();
     }
-}
-
-void NeuronLayer::addInput() {
-    numInputsPerNeuron++;
-    for (int i = 0; i < neurons.size(); i++) {
-        neurons[i].addInput();
+    
+    AlignedVector<Scalar> newParameters(size);
+    for (int i = 0; i < newLayers.size(); i++) { // iterate over layers
+        const NeuronLayer &layer = newLayers[i];
+        for (int j = 0; j < layer.numNeurons; j++) { // iterate over neurons
+            Scalar *row = &newParameters[layer.offset + (size_t)j * layer.numInputsPerNeuron];
+            for (int k = 0; k < layer.numInputsPerNeuron; k++) row[k] = source(i, j, k);
+            newParameters[layer.biasOffset() + j] = source(i, j, layer.numInputsPerNeuron);
+        }
     }
+    
+    layers.swap(newLayers); // only now do the old buffer and layers go away, source() may have been reading them
+    parameters.swap(newParameters);
+    sizeActivations();
 }
 
-void NeuronLayer::addNeuron() {
-    numNeurons++;
-    neurons.push_back(Neuron(numInputsPerNeuron));
-}
-
-void NeuronLayer::removeInput(int index) {
-    numInputsPerNeuron--;
-    for (int i = 0; i < neurons.size(); i++) neurons[i].removeInput(index);
-}
-
-void NeuronLayer::removeInput() {
-    numInputsPerNeuron--;
-    for (int i = 0; i < neurons.size(); i++) neurons[i].removeInput();
+template <typename Scalar>
+void NeuralNet<Scalar>::sizeActivations() {
+    structureVersion = ++lastStructureVersion;
+    int widest = 0;
+    for (int i = 0; i + 1 < layers.size(); i++) widest = std::max(widest, layers[i].numNeurons); // the output layer writes straight to the caller
+    activations[0].assign(widest, 0);
+    activations[1].assign(widest, 0);
+    batchActivations[0].clear();
+    batchActivations[1].clear();
+    buildSparseLayers();
 }
 
-void NeuronLayer::removeNeuron(int index) {
-    numNeurons--;
-    neurons.erase(neurons.begin() + index);
+template <typename Scalar>
+void NeuralNet<Scalar>::buildSparseLayers() {
+    sparseLayers.resize(sparse ? layers.size() : 0);
+    for (int i = 0; i < sparseLayers.size(); i++) {
+        const NeuronLayer &layer = layers[i];
+        SparseLayer<Scalar> &compressed = sparseLayers[i];
+        compressed.values.clear(); // clearing keeps the capacity, so training a sparse network does not reallocate
+        compressed.columns.clear();
+        compressed.rowStarts.clear();
+        
+        size_t cells = (size_t)layer.numNeurons * layer.numInputsPerNeuron;
+        if (cells == 0 || getNumberOfNonzeroWeights(i) > SPARSE_MAX_DENSITY * cells) continue; // dense evaluation is faster
+        compressed.rowStarts.push_back(0);
+        for (int j = 0; j < layer.numNeurons; j++) {
+            const Scalar *row = &parameters[layer.offset + (size_t)j * layer.numInputsPerNeuron];
+            for (int k = 0; k < layer.numInputsPerNeuron; k++) {
+                if (row[k] != 0) {
+                    compressed.values.push_back(row[k]);
+                    compressed.columns.push_back(k);
+                }
+            }
+            compressed.rowStarts.push_back(compressed.values.size());
+        }
+    }
 }
 
-void NeuronLayer::removeNeuron() {
-    numNeurons--;
-    neurons.erase(neurons.end() - 1);
+template <typename Scalar>
+void NeuralNet<Scalar>::resizeLayer(int layerIndex, const std::vector<int> &neuronSources, const std::vector<int> &inputSources) {
+    std::vector<NeuronLayer> newLayers = layers;
+    newLayers[layerIndex].numNeurons = neuronSources.size();
+    newLayers[layerIndex].numInputsPerNeuron = inputSources.size();
+    rebuild(newLayers, [&](int i, int j, int k) -> Scalar {
+        const NeuronLayer &old = layers[i];
+        if (i != layerIndex) { // untouched layer, copy straight across
+            return (k == old.numInputsPerNeuron) ? parameters[old.biasOffset() + j] : parameters[old.offset + (size_t)j * old.numInputsPerNeuron + k];
+        }
+        int oldNeuron = neuronSources[j];
+        if (oldNeuron < 0) return randomClamped(); // brand new neuron
+        if (k == (int)inputSources.size()) return parameters[old.biasOffset() + oldNeuron]; // the bias follows its neuron
+        int oldInput = inputSources[k];
+        if (oldInput < 0) return randomClamped(); // brand new synapse
+        return parameters[old.offset + (size_t)oldNeuron * old.numInputsPerNeuron + oldInput];
+    });
 }
 
-/////////////////////////
-// Neural Network
-
-const double NeuralNet::activationResponse = 1;
-const double NeuralNet::biasCoefficient = -1;
-
-NeuralNet::NeuralNet() {
-    numInputs = 0;
-    numOutputs = 0;
-    numHiddenLayers = 0;
-    
-    // create empty output layer
-    layers.push_back(NeuronLayer(0, 0));
+/// returns the identity mapping 0..count-1, used to describe the parts of a layer that do not move
+static std::vector<int> keepAll(int count) {
+    std::vector<int> sources(count);
+    for (int i = 0; i < count; i++) sources[i] = i;
+    return sources;
 }
 
-std::vector<std::string> NeuralNet::getInputs() const { return inputs; }
-std::vector<std::string> NeuralNet::getOutputs() const { return outputs; }
-std::vector<NeuronLayer> NeuralNet::getLayers() const { return layers; }
-
-void NeuralNet::addInput(std::string name) {
+template <typename Scalar>
+void NeuralNet<Scalar>::addInput(std::string name) {
     numInputs++;
     inputs.push_back(name);
-    layers[0].addInput();
+    std::vector<int> inputSources = keepAll(layers[0].numInputsPerNeuron);
+    inputSources.push_back(-1);
+    resizeLayer(0, keepAll(layers[0].numNeurons), inputSources);
 }
 
-void NeuralNet::addOutput(std::string name) {
+template <typename Scalar>
+void NeuralNet<Scalar>::addOutput(std::string name) {
     numOutputs++;
     outputs.push_back(name);
-    layers.back().addNeuron();
+    std::vector<int> neuronSources = keepAll(layers.back().numNeurons);
+    neuronSources.push_back(-1);
+    resizeLayer(layers.size() - 1, neuronSources, keepAll(layers.back().numInputsPerNeuron));
 }
 
-void NeuralNet::removeInput(std::string name) {
+template <typename Scalar>
+void NeuralNet<Scalar>::removeInput(std::string name) {
     std::vector<std::string>::iterator position = std::find(inputs.begin(), inputs.end(), name);
     if (position != inputs.end()) { // make sure the element exists
+        int index = position - inputs.begin();
         numInputs--;
         inputs.erase(position);
-        int index = position - inputs.begin();
-        layers[0].removeInput(index);
+        std::vector<int> inputSources = keepAll(layers[0].numInputsPerNeuron);
+        inputSources.erase(inputSources.begin() + index);
+        resizeLayer(0, keepAll(layers[0].numNeurons), inputSources);
     }
 }
 
-void NeuralNet::removeOutput(std::string name) {
+template <typename Scalar>
+void NeuralNet<Scalar>::removeOutput(std::string name) {
     std::vector<std::string>::iterator position = std::find(outputs.begin(), outputs.end(), name);
     if (position != outputs.end()) { // make sure the element exists
+        int index = position - outputs.begin();
         numOutputs--;
         outputs.erase(position);
-        int index = position - outputs.begin();
-        layers.back().removeNeuron(index);
+        std::vector<int> neuronSources = keepAll(layers.back().numNeurons);
+        neuronSources.erase(neuronSources.begin() + index);
+        resizeLayer(layers.size() - 1, neuronSources, keepAll(layers.back().numInputsPerNeuron));
     }
 }
 
-void NeuralNet::addNeurons(int layer, int quantity) { // note: here, layer is 1-indexed relative to layers
+template <typename Scalar>
+void NeuralNet<Scalar>::addNeurons(int layer, int quantity) { // note: here, layer is 1-indexed relative to layers
     if (layer == layers.size()) {
         std::cerr << "Cannot add neurons to output layer using 'neuronadd'! Use 'outputadd' instead." << std::endl;
     } else if (layer == 0) {
@@ -135,172 +178,357 @@ void NeuralNet::addNeurons(int layer, int quantity) { // note: here, layer is 1-
     } else if (layer < 0 || layer > layers.size()) {
         std::cerr << "Layer " << layer << " is not a valid layer." << std::endl;
     } else { // layer is a hidden layer
-        for (int i = 0; i < quantity; i++) {
-            layers[layer-1].addNeuron();
-            layers[layer].addInput(); // add downstream synapses
-        }
+        std::vector<int> neuronSources = keepAll(layers[layer-1].numNeurons);
+        neuronSources.resize(neuronSources.size() + quantity, -1);
+        resizeLayer(layer-1, neuronSources, keepAll(layers[layer-1].numInputsPerNeuron));
+        std::vector<int> inputSources = keepAll(layers[layer].numInputsPerNeuron);
+        inputSources.resize(inputSources.size() + quantity, -1);
+        resizeLayer(layer, keepAll(layers[layer].numNeurons), inputSources); // add downstream synapses
     }
 }
 
-void NeuralNet::removeNeurons(int layer, int quantity) { // note: here, layer is 1-indexed relative to layers
+template <typename Scalar>
+void NeuralNet<Scalar>::removeNeurons(int layer, int quantity) { // note: here, layer is 1-indexed relative to layers
     if (layer == layers.size()) {
         std::cerr << "Cannot remove neurons from output layer using 'neuronremove'! Use 'outputremove' instead." << std::endl;
     } else if (layer == 0) {
         std::cerr << "Cannot remove neurons from intput layer using 'neuronremove'! Use 'inputremove' instead." << std::endl;
+    } else if (layer < 0 || layer > layers.size()) {
+        std::cerr << "Layer " << layer << " is not a valid layer." << std::endl;
     } else { // layer is a hidden layer
-        for (int i = 0; i < quantity; i++) {
-            layers[layer-1].removeNeuron();
-            layers[layer].removeInput(); // remove downstream synapses
-        }
+        quantity = std::min(quantity, layers[layer-1].numNeurons);
+        resizeLayer(layer-1, keepAll(layers[layer-1].numNeurons - quantity), keepAll(layers[layer-1].numInputsPerNeuron));
+        resizeLayer(layer, keepAll(layers[layer].numNeurons), keepAll(layers[layer].numInputsPerNeuron - quantity)); // remove downstream synapses
     }
 }
 
 
-void NeuralNet::addLayerBeforeOutputLayer(int numNeurons, int numInputsPerNeuron) {
-    layers.insert(layers.end() - 1, NeuronLayer(numNeurons, numInputsPerNeuron));
+template <typename Scalar>
+void NeuralNet<Scalar>::addLayerBeforeOutputLayer(int numNeurons, int numInputsPerNeuron) {
+    std::vector<NeuronLayer> newLayers = layers;
+    newLayers.insert(newLayers.end() - 1, NeuronLayer(numNeurons, numInputsPerNeuron));
+    newLayers.back().numInputsPerNeuron = numNeurons; // the output layer now listens to the new layer
+    int outputIndex = newLayers.size() - 1;
+    rebuild(newLayers, [&](int i, int j, int k) -> Scalar {
+        if (i >= outputIndex - 1) return randomClamped(); // new layer, and output synapses that now have a new source
+        const NeuronLayer &old = layers[i];
+        return (k == old.numInputsPerNeuron) ? parameters[old.biasOffset() + j] : parameters[old.offset + (size_t)j * old.numInputsPerNeuron + k];
+    });
 }
 
-void NeuralNet::addLayer(int layerIndex, int numNeurons) { // note: here, layer is 1-indexed relative to layers
-    int numInputsPerNeuron = layers[layerIndex - 1].numInputsPerNeuron; // adopt same number of inputs
-    layers.insert(layers.begin() + layerIndex - 1, NeuronLayer(numNeurons, numInputsPerNeuron));
+template <typename Scalar>
+void NeuralNet<Scalar>::addLayer(int layerIndex, int numNeurons) { // note: here, layer is 1-indexed relative to layers
+    if (layerIndex < 1 || layerIndex > layers.size()) {
+        std::cerr << "Layer " << layerIndex << " is not a valid layer." << std::endl;
+        return;
+    }
+    int inserted = layerIndex - 1; // index of the new layer, the layer previously here shifts to layerIndex
+    const NeuronLayer displaced = layers[inserted];
     
-    for (int j = 0; j < layers[layerIndex - 1].numNeurons; ++j) { // iterate over new neurons
-        if (j >= layers[layerIndex].numNeurons) break;
-        layers[layerIndex - 1].neurons[j].weights = layers[layerIndex].neurons[j].weights; // adopt weights from layer that was here previously
+    // precompute the average incoming weight of each displaced neuron (- bias)
+    std::vector<Scalar> averageWeights(displaced.numNeurons, 0);
+    for (int j = 0; j < displaced.numNeurons; ++j) {
+        const Scalar *row = &parameters[displaced.offset + (size_t)j * displaced.numInputsPerNeuron];
+        Scalar sum = 0;
+        for (int k = 0; k < displaced.numInputsPerNeuron; ++k) sum += row[k];
+        if (displaced.numInputsPerNeuron > 0) averageWeights[j] = sum / displaced.numInputsPerNeuron;
     }
     
-    for (int j = 0; j < layers[layerIndex].numNeurons; ++j) { // iterate over preexisting neurons
-        double sum = 0;
-        for (int k = 0; k < layers[layerIndex].neurons[j].numInputs - 1; ++k) { // iterate over weights (- bias)
-            sum += layers[layerIndex].neurons[j].weights[k];
+    std::vector<NeuronLayer> newLayers = layers;
+    newLayers.insert(newLayers.begin() + inserted, NeuronLayer(numNeurons, displaced.numInputsPerNeuron)); // adopt same number of inputs
+    newLayers[layerIndex].numInputsPerNeuron = numNeurons; // update preexisting layer number of inputs
+    
+    rebuild(newLayers, [&](int i, int j, int k) -> Scalar {
+        if (i == inserted) { // new neurons adopt weights (and bias) from the layer that was here previously
+            if (j >= displaced.numNeurons) return randomClamped();
+            return (k == displaced.numInputsPerNeuron) ? parameters[displaced.biasOffset() + j] : parameters[displaced.offset + (size_t)j * displaced.numInputsPerNeuron + k];
         }
-        double bias = layers[layerIndex].neurons[j].weights[layers[layerIndex].neurons[j].numInputs - 1]; // save bias
-        double averageWeight = sum / (layers[layerIndex].neurons[j].numInputs - 1); // calculate average weight (- bias)
-        layers[layerIndex].neurons[j].numInputs = numNeurons + 1; // update number of downstream inputs (+ bias)
-        layers[layerIndex].neurons[j].weights.clear(); // dump old weights
-        for (int k = 0; k < layers[layerIndex].neurons[j].numInputs - 1; ++k) { // iterate over new number of weights (- bias)
-            layers[layerIndex].neurons[j].weights.push_back(averageWeight); // add new weight, average of old weights
+        if (i == layerIndex) { // preexisting neurons keep their bias, every new synapse is the average of the old ones
+            return (k == numNeurons) ? parameters[displaced.biasOffset() + j] : averageWeights[j];
         }
-        layers[layerIndex].neurons[j].weights.push_back(bias); // restore bias
-    }
-    layers[layerIndex].numInputsPerNeuron = numNeurons; // update preexisting layer number of inputs
+        const NeuronLayer &old = layers[i < inserted ? i : i - 1];
+        return (k == old.numInputsPerNeuron) ? parameters[old.biasOffset() + j] : parameters[old.offset + (size_t)j * old.numInputsPerNeuron + k];
+    });
 }
 
-void NeuralNet::removeLayer(int layerIndex) { // note: here, layer is 1-indexed relative to layers
-    layers[layerIndex].numInputsPerNeuron = layers[layerIndex-1].numInputsPerNeuron; // adopt number of inputs
-    
-    for (int j = 0; j < layers[layerIndex].numNeurons; ++j) { // iterate over preexisting, downstream neurons
-        float bias = layers[layerIndex].neurons[j].weights[layers[layerIndex].neurons[j].numInputs - 1];
-        layers[layerIndex].neurons[j].numInputs = layers[layerIndex].numInputsPerNeuron; // update number of inputs
-        if (j >= layers[layerIndex].numNeurons) {
-            for (int i = 0; i < layers[layerIndex].neurons[j].numInputs; i++) // no weights to adopt, so make random
-        		layers[layerIndex].neurons[j].weights.push_back(randomClamped());
-        } else {
-            layers[layerIndex].neurons[j].weights = layers[layerIndex-1].neurons[j].weights; // adopt weights from layer to be removed
-        }
-        layers[layerIndex].neurons[j].weights[layers[layerIndex].neurons[j].numInputs - 1] = bias; // don't adopt bias
+template <typename Scalar>
+void NeuralNet<Scalar>::removeLayer(int layerIndex) { // note: here, layer is 1-indexed relative to layers
+    if (layerIndex < 1 || layerIndex >= layers.size()) {
+        std::cerr << "Layer " << layerIndex << " is not a valid hidden layer." << std::endl;
+        return;
     }
+    int removed = layerIndex - 1;
+    const NeuronLayer doomed = layers[removed];
+    const NeuronLayer downstream = layers[layerIndex];
+    
+    std::vector<NeuronLayer> newLayers = layers;
+    newLayers[layerIndex].numInputsPerNeuron = doomed.numInputsPerNeuron; // adopt number of inputs
+    newLayers.erase(newLayers.begin() + removed);
     
-    layers.erase(layers.begin() + layerIndex - 1);
+    rebuild(newLayers, [&](int i, int j, int k) -> Scalar {
+        if (i == removed) { // downstream neurons adopt weights from the layer being removed, but keep their own bias
+            if (k == doomed.numInputsPerNeuron) return parameters[downstream.biasOffset() + j];
+            if (j >= doomed.numNeurons) return randomClamped(); // no weights to adopt, so make random
+            return parameters[doomed.offset + (size_t)j * doomed.numInputsPerNeuron + k];
+        }
+        const NeuronLayer &old = layers[i < removed ? i : i + 1];
+        return (k == old.numInputsPerNeuron) ? parameters[old.biasOffset() + j] : parameters[old.offset + (size_t)j * old.numInputsPerNeuron + k];
+    });
 }
 
 
-void NeuralNet::randomizeWeights() {
-    for (int i = 0; i < numHiddenLayers + 1; ++i) { // iterate over layers
-		for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-			for (int k = 0; k < layers[i].neurons[j].numInputs; ++k) { // iterate over weights
-                layers[i].neurons[j].weights[k] = randomClamped();
-			}		
-		}
-	}
+template <typename Scalar>
+void NeuralNet<Scalar>::randomizeWeights() {
+    for (size_t i = 0; i < parameters.size(); ++i) parameters[i] = randomClamped();
+    buildSparseLayers();
 }
 
-void NeuralNet::zeroWeights() {
-    for (int i = 0; i < numHiddenLayers + 1; ++i) { // iterate over layers
-		for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-			for (int k = 0; k < layers[i].neurons[j].numInputs; ++k) { // iterate over weights
-                layers[i].neurons[j].weights[k] = 0;
-			}		
-		}
-	}
+template <typename Scalar>
+void NeuralNet<Scalar>::zeroWeights() {
+    std::fill(parameters.begin(), parameters.end(), 0);
+    buildSparseLayers();
 }
 
-std::vector<double> NeuralNet::getWeights() const {
-    std::vector<double> weights;
-	for (int i = 0; i < numHiddenLayers + 1; ++i) { // iterate over layers
-		for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-			for (int k = 0; k < layers[i].neurons[j].numInputs; ++k) { // iterate over weights
-				weights.push_back(layers[i].neurons[j].weights[k]);
-			}
-		}
-	}
-	return weights;
+template <typename Scalar>
+Span<Scalar> NeuralNet<Scalar>::getWeights() { return Span<Scalar>(parameters); }
+template <typename Scalar>
+Span<const Scalar> NeuralNet<Scalar>::getWeights() const { return Span<const Scalar>(parameters); }
+
+template <typename Scalar>
+int NeuralNet<Scalar>::getNumberOfWeights() const {
+	return parameters.size();
 }
 
-int NeuralNet::getNumberOfWeights() const {
-    int count = 0;
-	for (int i = 0; i < numHiddenLayers + 1; ++i) { // iterate over layers
+template <typename Scalar>
+void NeuralNet<Scalar>::setWeights(Span<const Scalar> weights) {
+    if (weights.size() != parameters.size()) {
+        std::cerr << "Incorrect number of weights! Expected " << parameters.size() << ", received " << weights.size() << std::endl;
+        return;
+    }
+    std::copy(weights.begin(), weights.end(), parameters.begin());
+    buildSparseLayers();
+}
+
+template <typename Scalar>
+std::vector<Scalar> NeuralNet<Scalar>::getWeightsByNeuron() const {
+    std::vector<Scalar> weights;
+    weights.reserve(parameters.size());
+	for (int i = 0; i < layers.size(); ++i) { // iterate over layers
 		for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-			for (int k = 0; k < layers[i].neurons[j].numInputs; ++k) { // iterate over weights
-				count++;
-			}		
+            const Scalar *row = &parameters[layers[i].offset + (size_t)j * layers[i].numInputsPerNeuron];
+            weights.insert(weights.end(), row, row + layers[i].numInputsPerNeuron);
+            weights.push_back(parameters[layers[i].biasOffset() + j]);
 		}
 	}
-	return count;
+	return weights;
 }
 
-void NeuralNet::setWeights(std::vector<double> &weights) {
+template <typename Scalar>
+void NeuralNet<Scalar>::setWeightsByNeuron(const std::vector<Scalar> &weights) {
+    if (weights.size() != parameters.size()) {
+        std::cerr << "Incorrect number of weights! Expected " << parameters.size() << ", received " << weights.size() << std::endl;
+        return;
+    }
     int currentWeight = 0;
-	for (int i = 0; i < numHiddenLayers + 1; ++i) { // iterate over layers
+	for (int i = 0; i < layers.size(); ++i) { // iterate over layers
 		for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-			for (int k = 0; k < layers[i].neurons[j].numInputs; ++k) { // iterate over weights
-				layers[i].neurons[j].weights[k] = weights[currentWeight++];
-			}
+            Scalar *row = &parameters[layers[i].offset + (size_t)j * layers[i].numInputsPerNeuron];
+			for (int k = 0; k < layers[i].numInputsPerNeuron; ++k) row[k] = weights[currentWeight++];
+            parameters[layers[i].biasOffset() + j] = weights[currentWeight++];
 		}
 	}
+    buildSparseLayers();
 }
 
-std::vector<double> NeuralNet::propagate(std::vector<double> &inputs) {
-    std::vector<double> outputs; // the resultant outputs from each layer
-
-    // error check number of inputs
-    if (inputs.size() != numInputs) {
-        std::cerr << "Incorrect number of inputs! Expected " << numInputs << ", received " << inputs.size() << std::endl;
-        return outputs; // return empty vector
+template <typename Scalar>
+int NeuralNet<Scalar>::prune(Scalar threshold) {
+    int zeroed = 0;
+    for (const NeuronLayer &layer : layers) {
+        Scalar *matrix = &parameters[layer.offset];
+        for (size_t k = 0; k < (size_t)layer.numNeurons * layer.numInputsPerNeuron; k++) {
+            if (fabs(matrix[k]) < threshold) matrix[k] = 0;
+            if (matrix[k] == 0) zeroed++;
+        }
     }
+    setSparse(true);
+    return zeroed;
+}
 
-    // iterate over layers
-    for (int i = 0; i < numHiddenLayers + 1; ++i) {
+template <typename Scalar>
+int NeuralNet<Scalar>::pruneFraction(double fraction) {
+    int zeroed = 0;
+    std::vector<Scalar> magnitudes;
+    for (const NeuronLayer &layer : layers) {
+        Scalar *matrix = &parameters[layer.offset];
+        size_t cells = (size_t)layer.numNeurons * layer.numInputsPerNeuron;
+        size_t count = std::min<size_t>(cells, (size_t)(fraction * cells + 0.5)); // how many of this layer's weights go
+        if (count == 0) continue;
         
-        if ( i > 0 ) // if not the input layer
-            inputs = outputs;
+        // the count-th smallest magnitude is the layer's threshold, ties at it are broken in order
+        magnitudes.resize(cells);
+        for (size_t k = 0; k < cells; k++) magnitudes[k] = fabs(matrix[k]);
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + (count - 1), magnitudes.end());
+        Scalar threshold = magnitudes[count - 1];
+        size_t below = 0;
+        for (size_t k = 0; k < cells; k++) if (fabs(matrix[k]) < threshold) below++;
+        size_t ties = count - below;
+        for (size_t k = 0; k < cells; k++) {
+            Scalar magnitude = fabs(matrix[k]);
+            if (magnitude < threshold || (magnitude == threshold && ties > 0 && ties--)) matrix[k] = 0;
+        }
+    }
+    setSparse(true);
+    for (int i = 0; i < layers.size(); i++) zeroed += (size_t)layers[i].numNeurons * layers[i].numInputsPerNeuron - getNumberOfNonzeroWeights(i);
+    return zeroed;
+}
 
-        outputs.clear();
+template <typename Scalar>
+void NeuralNet<Scalar>::setSparse(bool enabled) {
+    sparse = enabled;
+    buildSparseLayers();
+}
 
-        int cWeight = 0; // the current weight
+template <typename Scalar>
+bool NeuralNet<Scalar>::isLayerSparse(int layer) const {
+    return layer < sparseLayers.size() && !sparseLayers[layer].rowStarts.empty();
+}
 
-        // for each neuron sum the (inputs * corresponding weights). Throw the total at our sigmoid function to get the output.
-        for (int j = 0; j < layers[i].numNeurons; ++j) { // iterate over neurons
-            double netInput = 0;
-            int	lclnumInputs = layers[i].neurons[j].numInputs;
+template <typename Scalar>
+size_t NeuralNet<Scalar>::getNumberOfNonzeroWeights(int layer) const {
+    if (isLayerSparse(layer)) return sparseLayers[layer].values.size();
+    const Scalar *matrix = &parameters[layers[layer].offset];
+    size_t cells = (size_t)layers[layer].numNeurons * layers[layer].numInputsPerNeuron;
+    return cells - std::count(matrix, matrix + cells, (Scalar)0);
+}
 
-            for (int k = 0; k < lclnumInputs - 1; ++k) { // iterate over weights
-                netInput += layers[i].neurons[j].weights[k] * inputs[cWeight++]; // evaluate the linear combination
-            }
+template <typename Scalar>
+void NeuralNet<Scalar>::setThreadPool(ThreadPool *pool, int minimumWidth) {
+    threadPool = pool;
+    parallelMinimumWidth = minimumWidth;
+}
 
-            netInput += layers[i].neurons[j].weights[lclnumInputs-1] * biasCoefficient; // add in the bias
+#define PARALLEL_ROW_GRAIN 16 ///< rows handed to a thread come in multiples of this, so no two threads write the same cache line of outputs
+
+/// one layer of a propagation, as handed to the thread pool
+template <typename Scalar>
+struct LayerJob {
+    const NeuronLayer *layer;
+    const Scalar *weights;
+    const Scalar *biases;
+    const SparseLayer<Scalar> *compressed; ///< NULL when the layer is dense
+    const Scalar *inputs;
+    Scalar *outputs;
+    int count; ///< samples
+};
+
+/// evaluates rows [begin, end) of the job's layer for one sample, or every row for samples [begin, end) of a batch
+template <typename Scalar>
+static void forwardLayerPart(const LayerJob<Scalar> &job, int begin, int end) {
+    const NeuronLayer &layer = *job.layer;
+    const Scalar bias = NeuralNet<Scalar>::biasCoefficient, response = NeuralNet<Scalar>::activationResponse;
+    if (job.count == 1) {
+        if (job.compressed) {
+            kernels<Scalar>().layerSparse(job.compressed->values.data(), job.compressed->columns.data(), job.compressed->rowStarts.data() + begin, job.biases + begin, job.inputs, job.outputs + begin, end - begin, bias, response);
+        } else {
+            kernels<Scalar>().layerForward(job.weights + (size_t)begin * layer.numInputsPerNeuron, job.biases + begin, job.inputs, job.outputs + begin, end - begin, layer.numInputsPerNeuron, bias, response);
+        }
+    } else if (job.compressed) { // one sample at a time, the scattered reads gain nothing from tiling
+        for (int s = begin; s < end; s++) {
+            kernels<Scalar>().layerSparse(job.compressed->values.data(), job.compressed->columns.data(), job.compressed->rowStarts.data(), job.biases, job.inputs + (size_t)s * layer.numInputsPerNeuron, job.outputs + (size_t)s * layer.numNeurons, layer.numNeurons, bias, response);
+        }
+    } else {
+        kernels<Scalar>().layerForwardBatch(job.weights, job.biases, job.inputs + (size_t)begin * layer.numInputsPerNeuron, job.outputs + (size_t)begin * layer.numNeurons, end - begin, layer.numNeurons, layer.numInputsPerNeuron, bias, response);
+    }
+}
 
-            outputs.push_back(sigmoid(netInput, activationResponse)); // store output and pass activation through sigmoid
+/// ThreadPool::Task for a LayerJob: a single sample is split by rows, a batch by samples
+template <typename Scalar>
+static void forwardLayerTask(void *context, int part, int parts) {
+    const LayerJob<Scalar> &job = *(const LayerJob<Scalar> *)context;
+    int total = job.count == 1 ? job.layer->numNeurons : job.count;
+    int grain = job.count == 1 ? PARALLEL_ROW_GRAIN : 1;
+    int share = ((total + parts - 1) / parts + grain - 1) / grain * grain;
+    int begin = std::min(total, part * share), end = std::min(total, begin + share);
+    if (begin < end) forwardLayerPart(job, begin, end);
+}
 
-            cWeight = 0;
-        }
+template <typename Scalar>
+void NeuralNet<Scalar>::forwardLayer(int layerIndex, const Scalar *layerInputs, Scalar *layerOutputs, int count) {
+    // for each neuron sum the (inputs * corresponding weights) and the bias, then pass the total through our sigmoid function
+    const NeuronLayer &layer = layers[layerIndex];
+    LayerJob<Scalar> job = { &layer, &parameters[layer.offset], &parameters[layer.biasOffset()], isLayerSparse(layerIndex) ? &sparseLayers[layerIndex] : NULL, layerInputs, layerOutputs, count };
+    if (threadPool && threadPool->size() > 1 && layer.numNeurons >= parallelMinimumWidth) {
+        threadPool->run(forwardLayerTask<Scalar>, &job); // returns once every part is written, the next layer may read them
+    } else {
+        forwardLayerPart(job, 0, count == 1 ? layer.numNeurons : count);
     }
+}
 
+template <typename Scalar>
+std::vector<Scalar> NeuralNet<Scalar>::propagate(const std::vector<Scalar> &inputs) {
+    std::vector<Scalar> outputs(numOutputs); // the resultant outputs from the output layer
+    if (!propagate(Span<const Scalar>(inputs), Span<Scalar>(outputs))) outputs.clear(); // return empty vector
     return outputs;
 }
 
-double NeuralNet::sigmoid(double activation, double response) {
-    return 1 / (1 + exp(-activation / response));
+template <typename Scalar>
+bool NeuralNet<Scalar>::propagate(Span<const Scalar> inputs, Span<Scalar> outputs) {
+    // error check number of inputs and outputs
+    if (inputs.size() != numInputs || outputs.size() != numOutputs) {
+        std::cerr << "Incorrect number of inputs or outputs! Expected " << numInputs << " and " << numOutputs << ", received " << inputs.size() << " and " << outputs.size() << std::endl;
+        return false;
+    }
+
+    // iterate over layers, bouncing between the two activation buffers until the output layer writes to the caller
+    const Scalar *layerInputs = inputs.data();
+    for (int i = 0; i < layers.size(); ++i) {
+        Scalar *layerOutputs = (i + 1 == layers.size()) ? outputs.data() : activations[i % 2].data();
+
+        forwardLayer(i, layerInputs, layerOutputs, 1);
+        layerInputs = layerOutputs;
+    }
+
+    return true;
+}
+
+template <typename Scalar>
+std::vector<Scalar> NeuralNet<Scalar>::propagateBatch(Span<const Scalar> inputs, int count) {
+    std::vector<Scalar> outputs((size_t)count * numOutputs); // one row per sample
+    if (!propagateBatch(inputs, count, Span<Scalar>(outputs))) outputs.clear(); // return empty vector
+    return outputs;
+}
+
+template <typename Scalar>
+bool NeuralNet<Scalar>::propagateBatch(Span<const Scalar> inputs, int count, Span<Scalar> outputs) {
+    // error check number of inputs and outputs
+    if (inputs.size() != (size_t)count * numInputs || outputs.size() != (size_t)count * numOutputs) {
+        std::cerr << "Incorrect number of inputs or outputs! Expected " << (size_t)count * numInputs << " and " << (size_t)count * numOutputs << ", received " << inputs.size() << " and " << outputs.size() << std::endl;
+        return false;
+    }
+    
+    size_t needed = (size_t)count * activations[0].size();
+    if (batchActivations[0].size() < needed) { // only grows, so repeated batches of the same size reuse the buffers
+        batchActivations[0].resize(needed);
+        batchActivations[1].resize(needed);
+    }
+
+    // iterate over layers, every sample passes through a layer before the next layer starts
+    const Scalar *layerInputs = inputs.data();
+    for (int i = 0; i < layers.size(); ++i) {
+        Scalar *layerOutputs = (i + 1 == layers.size()) ? outputs.data() : batchActivations[i % 2].data();
+        forwardLayer(i, layerInputs, layerOutputs, count);
+        layerInputs = layerOutputs;
+    }
+
+    return true;
+}
+
+template <typename Scalar>
+Scalar NeuralNet<Scalar>::sigmoid(Scalar activation, Scalar response) {
+    kernels<Scalar>().sigmoid(&activation, 1, response); // same Activation as propagation
+    return activation;
 }
 
 
+template class NeuralNet<float>;
+template class NeuralNet<double>;
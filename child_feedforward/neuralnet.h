@@ -9,47 +9,69 @@
 #include <iostream>
 #include <algorithm>
 #include <math.h>
+#include <functional>
+#include <stdint.h>
 
-struct Neuron {
-	int numInputs; ///< the number of inputs/synapses into the neuron (+ the bias)
-	std::vector<double> weights; ///< the corresponding weights for each input (+ the bias at the end)
-    Neuron(int numberInputs);
-    void addInput(); ///< adds a new input weight to the neuron
-    void removeInput(int index); ///< removes an input weight from the neuron
-    void removeInput(); ///< removes the last input weight (not the bias) from the neuron
-};
+#include "utils.h"
+
+class ThreadPool;
 
+/// NeuronLayer describes one fully connected layer. Its weights live in the owning NeuralNet's parameter buffer: a row-major
+/// numNeurons x numInputsPerNeuron matrix (one row per neuron) immediately followed by a bias vector of numNeurons entries.
 struct NeuronLayer {
 	int numNeurons; ///< the number of neurons in this layer
-    int numInputsPerNeuron; ///< the number of inputs that each neuron has
-	std::vector<Neuron> neurons; ///< the corresponding neurons
-	NeuronLayer(int numberNeurons, int numberInputsPerNeuron);
-	void addInput(); ///< adds a new input weight to every neuron in the layer
-    void addNeuron(); ///< adds a new neuron to the layer, not responsible for forming downstream synapses
-    void removeInput(int index); ///< removes an input weight from every neuron in the layer
-    void removeInput(); ///< removes the last input weight (not the bias) from every neuron in the layer
-    void removeNeuron(int index); ///< removes a neuron from the layer, not responsible for destroying downstream synapses
-    void removeNeuron(); ///< removes the last neuron from the layer, not responsible for destroying downstream synapses
+    int numInputsPerNeuron; ///< the number of inputs that each neuron has (not counting the bias)
+    size_t offset; ///< index of this layer's weight matrix within the network's parameter buffer
+	NeuronLayer(int numberNeurons, int numberInputsPerNeuron) : numNeurons(numberNeurons), numInputsPerNeuron(numberInputsPerNeuron), offset(0) {}
+    size_t biasOffset() const { return offset + (size_t)numNeurons * numInputsPerNeuron; } ///< index of the bias vector within the parameter buffer
+    int getNumberOfWeights() const { return numNeurons * numInputsPerNeuron + numNeurons; } ///< matrix + biases
 };
 
-/// NeuralNet is the neural network itself
+/// SparseLayer is the compressed sparse row form of a pruned layer's weight matrix: neuron j's nonzero weights are
+/// values[rowStarts[j] .. rowStarts[j + 1]) and columns holds the input each one reads. Biases stay in the parameter buffer.
+template <typename Scalar>
+struct SparseLayer {
+    AlignedVector<Scalar> values;
+    AlignedVector<int32_t> columns;
+    AlignedVector<int32_t> rowStarts; ///< numNeurons + 1 entries, empty while the layer is evaluated densely
+};
+
+/// NeuralNet is the neural network itself, Scalar (float or double) is the type of its weights, activations and I/O
+template <typename Scalar>
 class NeuralNet {
-    static const double activationResponse;
-    static const double biasCoefficient;
+public:
+    static const Scalar activationResponse;
+    static const Scalar biasCoefficient;
     
+private:
     int numInputs;
     int numOutputs;
-    int numHiddenLayers;
     
     std::vector<std::string> inputs;
     std::vector<std::string> outputs;
     std::vector<NeuronLayer> layers;
+    AlignedVector<Scalar> parameters; ///< every layer's weight matrix and bias vector, back to back, in layer order
+    AlignedVector<Scalar> activations[2]; ///< ping-pong buffers between layers for propagate(), sized for the widest hidden layer whenever the structure changes
+    AlignedVector<Scalar> batchActivations[2]; ///< the same for propagateBatch(), grown to the largest batch seen
+    int structureVersion; ///< renewed on every structural change, unique across networks
+    bool sparse; ///< set by pruning, propagation skips the zero weights of layers sparse enough for it to pay off
+    std::vector<SparseLayer<Scalar>> sparseLayers; ///< the compressed form of each layer when sparse, rebuilt whenever the weights change
+    ThreadPool *threadPool; ///< splits wide layers across threads when set, not owned
+    int parallelMinimumWidth; ///< layers with fewer neurons than this stay on the calling thread
+    
+    void forwardLayer(int layerIndex, const Scalar *layerInputs, Scalar *layerOutputs, int count); ///< evaluates one layer for count samples, across the thread pool when the layer is wide enough
+    void sizeActivations(); ///< resizes the activation buffers to fit the current structure
+    void buildSparseLayers(); ///< refreshes sparseLayers from the parameter buffer, picking the sparse form per layer by density
+    
+    void rebuild(std::vector<NeuronLayer> newLayers, std::function<Scalar(int, int, int)> source); ///< lays out a new parameter buffer for newLayers, source(layer, neuron, input) supplies each value (input == numInputsPerNeuron is the bias)
+    void resizeLayer(int layerIndex, const std::vector<int> &neuronSources, const std::vector<int> &inputSources); ///< reshapes one layer, each new neuron/input names the old index it keeps (-1 for a new random one)
 public:
     NeuralNet();
     
-    std::vector<std::string> getInputs() const;
-    std::vector<std::string> getOutputs() const;
-    std::vector<NeuronLayer> getLayers() const;
+    const std::vector<std::string> &getInputs() const;
+    const std::vector<std::string> &getOutputs() const;
+    int getStructureVersion() const { return structureVersion; } ///< changes whenever inputs, outputs or layers change, lets callers know when to resize their buffers
+    const std::vector<NeuronLayer> &getLayers() const;
     
     void addInput(std::string name);
     void addOutput(std::string name);
@@ -64,11 +86,28 @@ public:
     
     void randomizeWeights(); ///< rerandomizes all the weights in the network
     void zeroWeights(); ///< zeroes all the weights in the network
-    std::vector<double> getWeights() const; ///< returns the neural network's weights by layer
+    Span<Scalar> getWeights(); ///< returns a view of the neural network's weights by layer (each layer's matrix, then its biases), use setWeights() to change them on a sparse network
+    Span<const Scalar> getWeights() const;
     int getNumberOfWeights() const; ///< returns the total number of weights in the network
-    void setWeights(std::vector<double> &weights); ///< updates the network's weights with a new set
+    void setWeights(Span<const Scalar> weights); ///< updates the network's weights with a new set, in getWeights() order
+    std::vector<Scalar> getWeightsByNeuron() const; ///< returns the weights in the persisted order: neuron by neuron, each followed by its bias
+    void setWeightsByNeuron(const std::vector<Scalar> &weights); ///< updates the weights from the persisted order
+    
+    int prune(Scalar threshold); ///< zeroes every weight (biases are kept) smaller in magnitude than threshold and switches to sparse propagation, returns the number of weights now zero
+    int pruneFraction(double fraction); ///< zeroes the given fraction of each layer's weights, smallest magnitudes first, see prune()
+    void setSparse(bool enabled); ///< switches sparse propagation on or off, the weights are untouched
+    bool isSparse() const { return sparse; }
+    bool isLayerSparse(int layer) const; ///< true when the layer is currently evaluated in compressed sparse row form
+    size_t getNumberOfNonzeroWeights(int layer) const; ///< nonzero entries of the layer's weight matrix
+    
+    void setThreadPool(ThreadPool *pool, int minimumWidth); ///< splits the neurons of every layer at least minimumWidth wide across pool's threads, NULL goes back to one thread; the pool must outlive its use here
+    ThreadPool *getThreadPool() const { return threadPool; }
+    int getParallelMinimumWidth() const { return parallelMinimumWidth; }
     
-    std::vector<double> propagate(std::vector<double> &inputs); ///< propagates inputs through to find outputs
+    std::vector<Scalar> propagate(const std::vector<Scalar> &inputs); ///< propagates inputs through to find outputs
+    bool propagate(Span<const Scalar> inputs, Span<Scalar> outputs); ///< propagates inputs into the caller's outputs, does not allocate
+    std::vector<Scalar> propagateBatch(Span<const Scalar> inputs, int count); ///< propagates count samples at once, inputs is a row-major count x inputs matrix, returns a count x outputs matrix
+    bool propagateBatch(Span<const Scalar> inputs, int count, Span<Scalar> outputs); ///< propagateBatch into the caller's count x outputs matrix, does not allocate once a batch of this size has been seen
     
-    double sigmoid(double activation, double response); ///< the sigmoid response curve
+    Scalar sigmoid(Scalar activation, Scalar response); ///< the sigmoid response curve
 };
\ No newline at end of file
@@ -0,0 +1,125 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "quantized.h"
+#include "kernels.h"
+#include <math.h>
+
+/// maps value / scale onto [-127, 127], rounding to nearest
+template <typename Scalar>
+static inline int8_t quantizeValue(Scalar value, Scalar inverseScale) {
+    long q = lrint(value * inverseScale);
+    if (q > 127) q = 127;
+    if (q < -127) q = -127;
+    return (int8_t)q;
+}
+
+/// the scale that maps [-maximum, maximum] onto [-127, 127]
+template <typename Scalar>
+static inline Scalar scaleFor(Scalar maximum) {
+    return maximum > 0 ? maximum / 127 : 1;
+}
+
+template <typename Scalar>
+QuantizedNet<Scalar>::QuantizedNet() {
+    clear();
+}
+
+template <typename Scalar>
+void QuantizedNet<Scalar>::clear() {
+    numInputs = 0;
+    numOutputs = 0;
+    structureVersion = -1;
+    layers.clear();
+}
+
+template <typename Scalar>
+bool QuantizedNet<Scalar>::quantize(const NeuralNet<Scalar> &network, Span<const Scalar> calibrationInputs, int count) {
+    clear();
+    int inputs = network.getInputs().size();
+    if (count <= 0 || calibrationInputs.size() != (size_t)count * inputs) {
+        std::cerr << "Quantization needs at least one calibration sample with " << inputs << " inputs" << std::endl;
+        return false;
+    }
+    
+    const std::vector<NeuronLayer> &sourceLayers = network.getLayers();
+    Span<const Scalar> parameters = network.getWeights();
+    std::vector<Scalar> layerInputs(calibrationInputs.begin(), calibrationInputs.end()), layerOutputs;
+    size_t widest = inputs;
+    
+    for (int i = 0; i < sourceLayers.size(); i++) { // iterate over layers
+        const NeuronLayer &source = sourceLayers[i];
+        QuantizedLayer<Scalar> layer;
+        layer.numNeurons = source.numNeurons;
+        layer.numInputsPerNeuron = source.numInputsPerNeuron;
+        widest = std::max(widest, (size_t)source.numNeurons);
+        
+        // weights: one symmetric scale for the whole matrix
+        const Scalar *weights = parameters.data() + source.offset;
+        size_t numWeights = (size_t)source.numNeurons * source.numInputsPerNeuron;
+        Scalar largestWeight = 0;
+        for (size_t k = 0; k < numWeights; k++) largestWeight = std::max(largestWeight, (Scalar)fabs(weights[k]));
+        layer.weightScale = scaleFor(largestWeight);
+        layer.weights.resize(numWeights);
+        for (size_t k = 0; k < numWeights; k++) layer.weights[k] = quantizeValue(weights[k], 1 / layer.weightScale);
+        layer.biases.assign(parameters.data() + source.biasOffset(), parameters.data() + source.biasOffset() + source.numNeurons);
+        
+        // inputs: calibrate against what this layer actually receives from the calibration samples
+        Scalar largestInput = 0;
+        for (size_t k = 0; k < layerInputs.size(); k++) largestInput = std::max(largestInput, (Scalar)fabs(layerInputs[k]));
+        layer.inputScale = scaleFor(largestInput);
+        
+        // carry the samples through the original layer to calibrate the next one
+        layerOutputs.resize((size_t)count * source.numNeurons);
+        kernels<Scalar>().layerForwardBatch(weights, &layer.biases[0], layerInputs.data(), layerOutputs.data(), count, source.numNeurons, source.numInputsPerNeuron, NeuralNet<Scalar>::biasCoefficient, NeuralNet<Scalar>::activationResponse);
+        layerInputs.swap(layerOutputs);
+        
+        layers.push_back(layer);
+    }
+    
+    numInputs = inputs;
+    numOutputs = network.getOutputs().size();
+    structureVersion = network.getStructureVersion();
+    quantizedInputs.assign(widest, 0);
+    accumulators.assign(widest, 0);
+    activations.assign(widest, 0);
+    return true;
+}
+
+template <typename Scalar>
+bool QuantizedNet<Scalar>::propagate(Span<const Scalar> inputs, Span<Scalar> outputs) {
+    if (inputs.size() != numInputs || outputs.size() != numOutputs || layers.empty()) {
+        std::cerr << "Incorrect number of inputs or outputs for the quantized network! Expected " << numInputs << " and " << numOutputs << ", received " << inputs.size() << " and " << outputs.size() << std::endl;
+        return false;
+    }
+    
+    const Kernels<Scalar> &k = kernels<Scalar>();
+    const Scalar *layerInputs = inputs.data();
+    for (int i = 0; i < layers.size(); i++) { // iterate over layers
+        const QuantizedLayer<Scalar> &layer = layers[i];
+        Scalar *layerOutputs = (i + 1 == layers.size()) ? outputs.data() : activations.data();
+        
+        Scalar inverseInputScale = 1 / layer.inputScale;
+        for (int n = 0; n < layer.numInputsPerNeuron; n++) quantizedInputs[n] = quantizeValue(layerInputs[n], inverseInputScale);
+        k.layerInt8(layer.weights.data(), quantizedInputs.data(), accumulators.data(), layer.numNeurons, layer.numInputsPerNeuron);
+        
+        // dequantize, add the bias, then the sigmoid
+        Scalar scale = layer.weightScale * layer.inputScale;
+        for (int j = 0; j < layer.numNeurons; j++) layerOutputs[j] = accumulators[j] * scale + layer.biases[j] * NeuralNet<Scalar>::biasCoefficient;
+        k.sigmoid(layerOutputs, layer.numNeurons, NeuralNet<Scalar>::activationResponse);
+        layerInputs = layerOutputs;
+    }
+    return true;
+}
+
+template <typename Scalar>
+size_t QuantizedNet<Scalar>::getWeightBytes() const {
+    size_t bytes = 0;
+    for (int i = 0; i < layers.size(); i++) bytes += layers[i].weights.size() * sizeof(int8_t) + layers[i].biases.size() * sizeof(Scalar);
+    return bytes;
+}
+
+
+template class QuantizedNet<float>;
+template class QuantizedNet<double>;
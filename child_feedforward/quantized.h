@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+#include "neuralnet.h"
+#include "utils.h"
+
+/// QuantizedLayer is a NeuronLayer with int8 weights. Weights and layer inputs are quantized symmetrically,
+/// w ~= weightScale * qw and x ~= inputScale * qx, so weights[j] . inputs ~= weightScale * inputScale * (qw[j] . qx).
+/// Biases stay in the network's scalar type.
+template <typename Scalar>
+struct QuantizedLayer {
+    int numNeurons;
+    int numInputsPerNeuron;
+    Scalar weightScale; ///< largest |weight| in the layer / 127
+    Scalar inputScale; ///< largest |input| seen during calibration / 127
+    AlignedVector<int8_t> weights; ///< row-major numNeurons x numInputsPerNeuron
+    AlignedVector<Scalar> biases;
+};
+
+/// QuantizedNet is a post-training int8 copy of a NeuralNet used for fast inference. Build it with quantize(), which
+/// calibrates each layer's input range by running sample inputs (typically the training data) through the original network.
+/// Dot products run in integer arithmetic, the sigmoid is applied after dequantizing.
+template <typename Scalar>
+class QuantizedNet {
+    int numInputs;
+    int numOutputs;
+    int structureVersion; ///< the source network's structure version at quantization time
+    std::vector<QuantizedLayer<Scalar>> layers;
+    AlignedVector<int8_t> quantizedInputs; ///< the current layer's inputs, quantized
+    AlignedVector<int32_t> accumulators; ///< the current layer's integer dot products
+    AlignedVector<Scalar> activations; ///< the current layer's outputs
+public:
+    QuantizedNet();
+    
+    bool empty() const { return layers.empty(); }
+    void clear(); ///< drops the quantized copy
+    bool isStaleFor(const NeuralNet<Scalar> &network) const { return network.getStructureVersion() != structureVersion; } ///< true when the network's structure changed since quantize()
+    
+    /// quantizes network, calibrating the input ranges with count samples (a row-major count x inputs matrix)
+    bool quantize(const NeuralNet<Scalar> &network, Span<const Scalar> calibrationInputs, int count);
+    
+    bool propagate(Span<const Scalar> inputs, Span<Scalar> outputs); ///< propagates inputs into the caller's outputs, does not allocate
+    
+    size_t getWeightBytes() const; ///< memory taken by the quantized weights and biases
+};
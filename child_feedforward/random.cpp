@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "random.h"
+#include "kernels.h"
+#include <string.h>
+#include <atomic>
+
+/// splitmix64, expands a seed into well mixed state words
+static uint64_t splitMix(uint64_t &x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void Random::seed(uint64_t seed, uint64_t stream) {
+    uint64_t mix = seed;
+    for (int i = 0; i < 4; i++) state[i] = splitMix(mix);
+    for (uint64_t i = 0; i < stream; i++) jump();
+
+    // the lanes are seeded from this stream's own draws
+    mix = next();
+    for (int l = 0; l < RANDOM_LANES; l++) {
+        for (int i = 0; i < 4; i++) lanes[i][l] = splitMix(mix);
+    }
+}
+
+void Random::jump() {
+    static const uint64_t polynomial[4] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t jumped[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (polynomial[i] & (1ULL << b)) {
+                for (int w = 0; w < 4; w++) jumped[w] ^= state[w];
+            }
+            next();
+        }
+    }
+    memcpy(state, jumped, sizeof(state));
+}
+
+void Random::fill(double *values, size_t n) {
+    kernels<double>().uniform(lanes, values, n);
+}
+
+void Random::fill(float *values, size_t n) {
+    kernels<float>().uniform(lanes, values, n);
+}
+
+
+/////////////////////////
+// Per-thread streams
+
+static std::atomic<uint64_t> seedValue(0);
+static std::atomic<unsigned> seedEpoch(1); ///< bumped by seedRandom(), threads holding an older epoch restart their stream
+static std::atomic<int> nextStream(0);
+
+/// a thread's stream and the seeding it was built from
+struct ThreadStream {
+    Random random;
+    unsigned epoch;
+    ThreadStream() : epoch(0) {}
+};
+
+static thread_local ThreadStream threadStream;
+
+void seedRandom(uint64_t seed) {
+    seedValue = seed;
+    nextStream = 1; // 0 is the caller's
+    threadStream.epoch = ++seedEpoch;
+    threadStream.random.seed(seed, 0);
+}
+
+uint64_t randomSeed() {
+    return seedValue;
+}
+
+Random &threadRandom() {
+    ThreadStream &local = threadStream;
+    unsigned epoch = seedEpoch.load(std::memory_order_acquire);
+    if (local.epoch != epoch) {
+        local.random.seed(seedValue, nextStream++);
+        local.epoch = epoch;
+    }
+    return local.random;
+}
@@ -0,0 +1,125 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <string.h>
+
+#define RANDOM_LANES 8 ///< generators Random::fill() steps side by side, one per 64-bit slot of the widest vectors
+
+/// Random is a xoshiro256** generator for single draws, plus RANDOM_LANES xoshiro256+ generators behind fill() whose
+/// update has no multiply, so the lanes vectorize (see fillUniform(), built per instruction set as Kernels::uniform). A seed and a stream number pick the sequence: stream k
+/// starts 2^128 * k draws in, so streams of one seed never overlap.
+class Random {
+    uint64_t state[4];
+    uint64_t lanes[4][RANDOM_LANES]; ///< lanes[i][l] is word i of lane l, laid out for vector loads
+
+    void jump(); ///< advances state by 2^128 draws
+public:
+    explicit Random(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+    void seed(uint64_t seed, uint64_t stream = 0);
+
+    uint64_t next() {
+        const uint64_t result = rotate(state[1] * 5, 7) * 9;
+        const uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotate(state[3], 45);
+        return result;
+    }
+
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); } ///< in [0, 1), all 53 bits random
+    double clamped() { return uniform() - uniform(); } ///< in (-1, 1), the difference of two uniform draws
+    int range(int x, int y) { return x + (int)(((next() >> 32) * (uint64_t)(y - x + 1)) >> 32); } ///< in [x, y], by multiply and shift rather than a biased modulo
+    bool coin() { return next() >> 63; }
+
+    /// the number of failed trials before the first success, each succeeding with probability p where logKeep = log(1 - p):
+    /// the gap to the next mutated gene when each mutates with probability p, in one draw instead of one per gene
+    int geometric(double logKeep) {
+        if (logKeep >= 0) return INT32_MAX; // p = 0, never
+        double skip = floor(log(1 - uniform()) / logKeep);
+        return skip < INT32_MAX ? (int)skip : INT32_MAX;
+    }
+
+    void fill(double *values, size_t n); ///< n uniform draws in [0, 1) with 52 random bits, RANDOM_LANES at a time
+    void fill(float *values, size_t n); ///< the same with 23 random bits, two from each draw
+
+    static inline uint64_t rotate(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+/// reseeds every thread's stream from seed. The calling thread takes stream 0, other threads take the next free stream
+/// (in the order they first draw) and restart it from the new seed at their next draw.
+void seedRandom(uint64_t seed);
+uint64_t randomSeed(); ///< the seed last given to seedRandom()
+Random &threadRandom(); ///< the calling thread's stream, behind randInt(), randFloat() and friends
+
+
+/// steps the lanes count times, handing each step's RANDOM_LANES xoshiro256+ outputs to emit(step, outputs). The state is
+/// copied into locals so it stays in registers, and the lane loops are plain enough to vectorize.
+template <typename Isa, typename Emit>
+inline void stepLanes(uint64_t (&lanes)[4][RANDOM_LANES], size_t count, Emit emit) {
+    uint64_t s0[RANDOM_LANES], s1[RANDOM_LANES], s2[RANDOM_LANES], s3[RANDOM_LANES], results[RANDOM_LANES];
+    memcpy(s0, lanes[0], sizeof(s0));
+    memcpy(s1, lanes[1], sizeof(s1));
+    memcpy(s2, lanes[2], sizeof(s2));
+    memcpy(s3, lanes[3], sizeof(s3));
+    for (size_t step = 0; step < count; step++) {
+        for (int l = 0; l < RANDOM_LANES; l++) {
+            results[l] = s0[l] + s3[l];
+            const uint64_t t = s1[l] << 17;
+            s2[l] ^= s0[l];
+            s3[l] ^= s1[l];
+            s1[l] ^= s2[l];
+            s0[l] ^= s3[l];
+            s2[l] ^= t;
+            s3[l] = (s3[l] << 45) | (s3[l] >> 19); // spelled out rather than Random::rotate(), whose one definition may be a copy built for another instruction set
+        }
+        emit(step, results);
+    }
+    memcpy(lanes[0], s0, sizeof(s0));
+    memcpy(lanes[1], s1, sizeof(s1));
+    memcpy(lanes[2], s2, sizeof(s2));
+    memcpy(lanes[3], s3, sizeof(s3));
+}
+
+/// fills values with n uniform draws in [0, 1) from the lanes, 52 random bits each. Isa only keeps apart the copies each
+/// kernels_*.cpp builds for its own instruction set.
+template <typename Isa>
+inline void fillUniform(uint64_t (&lanes)[4][RANDOM_LANES], double *values, size_t n) {
+    size_t whole = n / RANDOM_LANES;
+    stepLanes<Isa>(lanes, whole + (n % RANDOM_LANES != 0), [&](size_t step, const uint64_t *results) {
+        double block[RANDOM_LANES];
+        for (int l = 0; l < RANDOM_LANES; l++) {
+            uint64_t bits = (results[l] >> 12) | 0x3ff0000000000000ULL; // the top 52 bits as the mantissa of a double in [1, 2)
+            memcpy(&block[l], &bits, sizeof(bits));
+            block[l] -= 1;
+        }
+        if (step < whole) memcpy(values + step * RANDOM_LANES, block, sizeof(block));
+        else memcpy(values + step * RANDOM_LANES, block, (n % RANDOM_LANES) * sizeof(double));
+    });
+}
+
+/// the same with 23 random bits, two from each draw
+template <typename Isa>
+inline void fillUniform(uint64_t (&lanes)[4][RANDOM_LANES], float *values, size_t n) {
+    const size_t perStep = 2 * RANDOM_LANES; // two floats out of every draw
+    size_t whole = n / perStep;
+    stepLanes<Isa>(lanes, whole + (n % perStep != 0), [&](size_t step, const uint64_t *results) {
+        float block[2 * RANDOM_LANES];
+        for (int l = 0; l < RANDOM_LANES; l++) { // 23 bits each from the top and the middle of the draw
+            uint32_t high = (uint32_t)(results[l] >> 41) | 0x3f800000u, low = ((uint32_t)(results[l] >> 9) & 0x7fffffu) | 0x3f800000u;
+            memcpy(&block[l], &high, sizeof(high));
+            memcpy(&block[RANDOM_LANES + l], &low, sizeof(low));
+        }
+        for (int l = 0; l < 2 * RANDOM_LANES; l++) block[l] -= 1;
+        if (step < whole) memcpy(values + step * perStep, block, sizeof(block));
+        else memcpy(values + step * perStep, block, (n % perStep) * sizeof(float));
+    });
+}
@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#include "threadpool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define THREADPOOL_SPINS 20000 ///< checks a waiting thread makes before it sleeps or yields
+
+ThreadPool::ThreadPool(int threads, bool pin) : task(NULL), context(NULL), generation(0), remaining(0), stopping(false) {
+    int cpus = hardwareThreads();
+    for (int part = 1; part < threads; part++) {
+        workers.push_back(std::thread(&ThreadPool::work, this, part, pin ? part % cpus : -1));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) worker.join();
+}
+
+int ThreadPool::hardwareThreads() {
+    int cpus = std::thread::hardware_concurrency();
+    return cpus > 0 ? cpus : 1;
+}
+
+void ThreadPool::work(int part, int cpu) {
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#else
+    (void)cpu; // no affinity API worth using elsewhere (macOS only takes hints), the scheduler places the thread
+#endif
+
+    unsigned seen = 0;
+    while (true) {
+        // spin a little in case the next layer follows right away, then sleep until run() or the destructor
+        for (int spin = 0; spin < THREADPOOL_SPINS && generation.load(std::memory_order_acquire) == seen && !stopping; spin++);
+        if (generation.load(std::memory_order_acquire) == seen && !stopping) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return generation.load(std::memory_order_acquire) != seen || stopping; });
+        }
+        if (stopping) return;
+        seen = generation.load(std::memory_order_acquire);
+
+        task(context, part, size());
+        remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ThreadPool::run(Task newTask, void *newContext) {
+    if (workers.empty()) { // single threaded, nothing to hand out
+        newTask(newContext, 0, 1);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = newTask;
+        context = newContext;
+        remaining.store(workers.size(), std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    newTask(newContext, 0, size()); // the caller's own part
+    for (int spin = 0; remaining.load(std::memory_order_acquire) > 0; spin++) {
+        if (spin > THREADPOOL_SPINS) std::this_thread::yield();
+    }
+}
@@ -0,0 +1,41 @@
+///////////////////////////////////////////////////////////////
+/// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
+///////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// ThreadPool runs one task split into as many parts as it has threads, the calling thread doing part 0. It is built for
+/// short, frequent jobs like a single layer of a propagation: workers spin briefly before sleeping so back to back runs
+/// skip the wake up, and run() neither allocates nor returns before every part is done.
+class ThreadPool {
+public:
+    typedef void (*Task)(void *context, int part, int parts); ///< does part of parts of the job described by context
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    Task task;
+    void *context;
+    std::atomic<unsigned> generation; ///< bumped for every run(), workers wait for it to move
+    std::atomic<int> remaining; ///< parts of the current run still going
+    std::atomic<bool> stopping;
+
+    void work(int part, int cpu); ///< a worker's loop, pinned to cpu when cpu >= 0
+
+public:
+    ThreadPool(int threads, bool pin); ///< threads counts the caller, pin ties worker i to CPU i
+    ~ThreadPool();
+
+    int size() const { return workers.size() + 1; }
+    void run(Task task, void *context); ///< calls task(context, part, size()) once for every part, returns when all are done
+
+    static int hardwareThreads(); ///< the number of CPUs, at least 1
+};
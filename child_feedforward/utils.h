@@ -2,26 +2,34 @@
 /// Copyright 2015 by Santiago Gonzalez <slgonzalez@me.com> ///
 ///////////////////////////////////////////////////////////////
 
+#pragma once
+
 #include <math.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <vector>
 #include <string>
+#include <iostream>
 #include <algorithm>
+#include <new>
+#include <type_traits>
+
+#include "allocations.h"
+#include "random.h"
+
+#define CACHE_LINE_SIZE 64 ///< alignment used for weight and activation buffers
 
 /// returns a random integer between x and y
-inline int randInt(int x,int y) { return rand() % (y-x+1) + x; }
+inline int randInt(int x,int y) { return threadRandom().range(x, y); }
 
 /// returns a random float between zero and 1
-inline double randFloat() { return (rand())/(RAND_MAX+1.0); }
+inline double randFloat() { return threadRandom().uniform(); }
 
 /// returns a random float between -1 and 1
-inline double randomClamped() { return randFloat() - randFloat(); }
+inline double randomClamped() { return threadRandom().clamped(); }
 
 /// returns a random bool
-inline bool randBool() {
-	if (randInt(0,1)) return true;
-	else return false;
-}
+inline bool randBool() { return threadRandom().coin(); }
 
 
 /// clamps a variable between two values
@@ -31,6 +39,91 @@ inline void clamp(double &arg, double min, double max) {
 }
 
 
+/// AlignedAllocator hands out cache line aligned blocks so buffers can be streamed by vector loads
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U> other; };
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+    T *allocate(size_t n) {
+        void *p = NULL;
+        countAllocation();
+        if (posix_memalign(&p, CACHE_LINE_SIZE, n * sizeof(T) > 0 ? n * sizeof(T) : CACHE_LINE_SIZE) != 0) throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t) { free(p); }
+    template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+/// a std::vector whose storage begins on a cache line boundary
+template <typename T> using AlignedVector = std::vector<T, AlignedAllocator<T> >;
+
+
+/// Span is a non-owning view of a contiguous run of values
+template <typename T>
+struct Span {
+    T *ptr;
+    size_t count;
+    Span() : ptr(NULL), count(0) {}
+    Span(T *ptr, size_t count) : ptr(ptr), count(count) {}
+    template <typename A> Span(std::vector<typename std::remove_const<T>::type, A> &v) : ptr(v.data()), count(v.size()) {}
+    template <typename A> Span(const std::vector<typename std::remove_const<T>::type, A> &v) : ptr(v.data()), count(v.size()) {}
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type> Span(const Span<U> &other) : ptr(other.ptr), count(other.count) {} ///< a view of mutable values is also a read-only view
+    T *data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T *begin() const { return ptr; }
+    T *end() const { return ptr + count; }
+    T &operator[](size_t i) const { return ptr[i]; }
+    Span<T> subspan(size_t offset, size_t n) const { return Span<T>(ptr + offset, n); }
+};
+
+
+/// writes a trivially copyable value to a binary stream as its raw bytes, in this machine's byte order
+template <typename T>
+inline void writeBinary(std::ostream &out, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value, "only raw bytes are written");
+    out.write((const char *)&value, sizeof(T));
+}
+
+/// writes the number of values and then the values themselves
+template <typename T, typename A>
+inline void writeBinary(std::ostream &out, const std::vector<T, A> &values) {
+    writeBinary(out, (uint64_t)values.size());
+    out.write((const char *)values.data(), values.size() * sizeof(T));
+}
+
+inline void writeBinary(std::ostream &out, const std::string &text) {
+    writeBinary(out, (uint64_t)text.size());
+    out.write(text.data(), text.size());
+}
+
+/// reads what writeBinary() wrote, fails on a short read
+template <typename T>
+inline bool readBinary(std::istream &in, T &value) {
+    static_assert(std::is_trivially_copyable<T>::value, "only raw bytes are read");
+    return (bool)in.read((char *)&value, sizeof(T));
+}
+
+/// reads a vector written by writeBinary(), also failing when its length is not the expected one
+template <typename T, typename A>
+inline bool readBinary(std::istream &in, std::vector<T, A> &values, size_t expected) {
+    uint64_t size;
+    if (!readBinary(in, size) || size != expected) return false;
+    values.resize(size);
+    return (bool)in.read((char *)values.data(), size * sizeof(T));
+}
+
+inline bool readBinary(std::istream &in, std::string &text) {
+    uint64_t size;
+    if (!readBinary(in, size) || size > (1 << 20)) return false; // no path is a megabyte long, the file is damaged
+    text.resize(size);
+    return (bool)in.read(&text[0], size);
+}
+
+
 /// splits a std::string into a std::vector given a delimiter character
 inline std::vector<std::string> string_split(std::string s, const char delimiter) {
     size_t start = 0;